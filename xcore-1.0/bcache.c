@@ -0,0 +1,378 @@
+#include "bcache.h"
+#include "types.h"
+#include "global.h"
+#include "list.h"
+#include "debug.h"
+#include "print.h"
+#include "string.h"
+#include "memory.h"
+#include "thread.h"
+#include "sync.h"
+#include "timer.h"
+#include "ide.h"
+
+// 所有缓冲区
+static struct buffer_head buffers[BCACHE_BUFFERS];
+// 按(disk, lba)散列的桶
+static struct list hash_table[BCACHE_HASH_SIZE];
+// 按最近使用时间排列的缓冲区,队首最久未用
+static struct list lru_list;
+// 保护以上结构和缓冲区的状态,等待硬盘读写时释放
+static struct lock bcache_lock;
+// 脏缓冲区数
+static uint32_t dirty_count;
+
+// 串行化回写,持有期间才能使用flush_heads
+// 获取顺序为先flush_lock后bcache_lock
+static struct lock flush_lock;
+// 回写时按扇区号排序的脏缓冲区
+static struct buffer_head *flush_heads[BCACHE_BUFFERS];
+
+// (disk, lba)所在的散列桶
+static struct list *bcache_bucket(struct disk *disk, uint32_t lba) {
+	return &hash_table[(lba ^ ((uint32_t) disk >> 4)) % BCACHE_HASH_SIZE];
+}
+
+// 查找(disk, lba)的缓冲区,不在缓存中时返回NULL
+static struct buffer_head *bcache_lookup(struct disk *disk, uint32_t lba) {
+	struct list *bucket = bcache_bucket(disk, lba);
+	struct list_ele *ele = bucket->head.next;
+	while(ele != &bucket->tail) {
+		struct buffer_head *bh = ELE2ENTRY(struct buffer_head, hash_tag, ele);
+		if(bh->disk == disk && bh->lba == lba) {
+			return bh;
+		}
+		ele = ele->next;
+	}
+	return NULL;
+}
+
+// a是否应排在b之前写回,同一硬盘按扇区号升序
+static bool bcache_before(struct buffer_head *a, struct buffer_head *b) {
+	if(a->disk != b->disk) {
+		return (uint32_t) a->disk < (uint32_t) b->disk;
+	}
+	return a->lba < b->lba;
+}
+
+// 让出CPU等待其他任务的读写完成,调用者持有bcache_lock,等待期间释放
+static void bcache_yield(void) {
+	lock_release(&bcache_lock);
+	thread_yield();
+	lock_acquire(&bcache_lock);
+}
+
+// 等待缓冲区bh的硬盘传输完成,调用者持有bcache_lock并已钉住bh
+static void bcache_wait_idle(struct buffer_head *bh) {
+	while(bh->busy) {
+		bcache_yield();
+	}
+}
+
+// 用bh自带的bio提交读写请求,完成时调用end_io,end_io为NULL时通知wait,调用者持有bcache_lock
+// 传输期间bh处于busy状态,不能读写内容也不能被淘汰
+static void bcache_submit(struct buffer_head *bh, bool write, bio_end_io *end_io, struct bio_wait *wait) {
+	ASSERT(!bh->busy);
+	bh->busy = true;
+	struct bio *bio = &bh->bio;
+	bio->disk = bh->disk;
+	bio->lba_start = bh->lba;
+	bio->sector_count = 1;
+	bio->buf = bh->data;
+	bio->write = write;
+	bio->end_io = end_io;
+	bio->wait = wait;
+	bio_submit(bio);
+}
+
+// 按扇区号顺序写回硬盘disk上[lba_start, lba_end)中的脏缓冲区,disk为NULL时写回所有脏缓冲区
+// 调用者持有bcache_lock,所有bio一起提交,相邻扇区在请求队列中合并为一次传输
+// 等待写完期间释放bcache_lock,返回时之前提交的回写都已完成
+static void bcache_writeback_locked(struct disk *disk, uint32_t lba_start, uint32_t lba_end) {
+	lock_release(&bcache_lock);
+	lock_acquire(&flush_lock);
+	lock_acquire(&bcache_lock);
+	// 插入排序
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+		struct buffer_head *bh = &buffers[i];
+		if(!bh->dirty || (disk != NULL \
+			&& (bh->disk != disk || bh->lba < lba_start || bh->lba >= lba_end))) {
+			continue;
+		}
+		uint32_t pos = count++;
+		while(pos > 0 && bcache_before(bh, flush_heads[pos - 1])) {
+			flush_heads[pos] = flush_heads[pos - 1];
+			--pos;
+		}
+		flush_heads[pos] = bh;
+	}
+	ASSERT(count <= dirty_count);
+	// 提交时就清除脏标记,传输期间再被写入的缓冲区重新变脏,留到下次回写
+	struct bio_wait wait;
+	bio_wait_init(&wait);
+	for(uint32_t i = 0; i < count; i++) {
+		flush_heads[i]->dirty = false;
+		bcache_submit(flush_heads[i], true, NULL, &wait);
+	}
+	dirty_count -= count;
+	lock_release(&bcache_lock);
+	bio_wait_all(&wait);
+	lock_acquire(&bcache_lock);
+	for(uint32_t i = 0; i < count; i++) {
+		flush_heads[i]->busy = false;
+	}
+	lock_release(&flush_lock);
+}
+
+// 写回所有脏缓冲区,调用者持有bcache_lock
+static void bcache_flush_locked(void) {
+	bcache_writeback_locked(NULL, 0, 0);
+}
+
+// 最久未用的可淘汰缓冲区,都在使用中时返回NULL
+static struct buffer_head *bcache_victim(void) {
+	struct list_ele *ele = lru_list.head.next;
+	while(ele != &lru_list.tail) {
+		struct buffer_head *bh = ELE2ENTRY(struct buffer_head, lru_tag, ele);
+		if(bh->pin_count == 0 && !bh->busy) {
+			return bh;
+		}
+		ele = ele->next;
+	}
+	return NULL;
+}
+
+// 取得(disk, lba)的缓冲区并移到lru_list队尾,调用者持有bcache_lock,期间可能释放
+// 不在缓存中时淘汰最久未用的缓冲区,此时*hit为false,缓冲区内容无效
+// 调用者需在释放bcache_lock前钉住它,或提交读请求,或写满它的内容
+static struct buffer_head *bcache_get(struct disk *disk, uint32_t lba, bool *hit) {
+	struct buffer_head *bh;
+	*hit = true;
+	while((bh = bcache_lookup(disk, lba)) == NULL) {
+		struct buffer_head *victim = bcache_victim();
+		if(victim == NULL) {
+			bcache_yield();
+			continue;
+		}
+		// 淘汰脏缓冲区前把所有脏缓冲区一起写回,减少零散的写
+		// 写回期间释放了bcache_lock,其他任务可能已读入(disk, lba),需重新查找
+		if(victim->dirty) {
+			bcache_flush_locked();
+			continue;
+		}
+		if(victim->disk != NULL) {
+			list_remove(&victim->hash_tag);
+		}
+		victim->disk = disk;
+		victim->lba = lba;
+		list_append(bcache_bucket(disk, lba), &victim->hash_tag);
+		*hit = false;
+		bh = victim;
+		break;
+	}
+	list_remove(&bh->lru_tag);
+	list_append(&lru_list, &bh->lru_tag);
+	return bh;
+}
+
+// 经缓存读取从lba开始的count个扇区到buf
+// 每批中未命中的扇区一起提交,等待期间释放bcache_lock,其他任务的命中不受影响
+void bcache_read(struct disk *disk, uint32_t lba, void *buf, uint32_t count) {
+	struct buffer_head *heads[BCACHE_BATCH];
+	bool missed[BCACHE_BATCH];
+	struct bio_wait wait;
+	bio_wait_init(&wait);
+	lock_acquire(&bcache_lock);
+	uint32_t done = 0;
+	while(done < count) {
+		uint32_t batch = count - done;
+		if(batch > BCACHE_BATCH) {
+			batch = BCACHE_BATCH;
+		}
+		for(uint32_t i = 0; i < batch; i++) {
+			bool hit;
+			heads[i] = bcache_get(disk, lba + done + i, &hit);
+			++heads[i]->pin_count;
+			missed[i] = !hit;
+			if(!hit) {
+				bcache_submit(heads[i], false, NULL, &wait);
+			}
+		}
+		lock_release(&bcache_lock);
+		bio_wait_all(&wait);
+		lock_acquire(&bcache_lock);
+		for(uint32_t i = 0; i < batch; i++) {
+			if(missed[i]) {
+				heads[i]->busy = false;
+			}
+		}
+		// 命中的缓冲区可能正由其他任务读入或写回
+		for(uint32_t i = 0; i < batch; i++) {
+			bcache_wait_idle(heads[i]);
+			memcpy((uint8_t*) buf + (done + i) * 512, heads[i]->data, 512);
+			--heads[i]->pin_count;
+		}
+		done += batch;
+	}
+	lock_release(&bcache_lock);
+}
+
+// 经缓存把buf中的count个扇区写到从lba开始的扇区,只标记为脏,之后再写回
+void bcache_write(struct disk *disk, uint32_t lba, void *buf, uint32_t count) {
+	lock_acquire(&bcache_lock);
+	for(uint32_t i = 0; i < count; i++) {
+		bool hit;
+		struct buffer_head *bh = bcache_get(disk, lba + i, &hit);
+		if(hit) {
+			++bh->pin_count;
+			bcache_wait_idle(bh);
+			--bh->pin_count;
+		}
+		// 整个扇区都被覆盖,未命中时无需先读入
+		memcpy(bh->data, (uint8_t*) buf + i * 512, 512);
+		if(!bh->dirty) {
+			bh->dirty = true;
+			++dirty_count;
+		}
+	}
+	if(dirty_count > BCACHE_DIRTY_LIMIT) {
+		bcache_flush_locked();
+	}
+	lock_release(&bcache_lock);
+}
+
+// 预读的bio完成时在硬盘中断中调用
+// 只有提交者会清除busy,这里不需要bcache_lock
+static void bcache_prefetch_done(struct bio *bio) {
+	struct buffer_head *bh = bio->private;
+	bh->busy = false;
+}
+
+// 把lbas中的count个扇区读入缓存,已在缓存中的跳过
+// 只提交读请求而不等待,相邻扇区在请求队列中合并为一次传输
+// 读完前缓冲区处于busy状态,读到它的任务会等待它完成
+void bcache_prefetch(struct disk *disk, uint32_t *lbas, uint32_t count) {
+	ASSERT(count <= BCACHE_PREFETCH_MAX);
+	lock_acquire(&bcache_lock);
+	for(uint32_t i = 0; i < count; i++) {
+		if(bcache_lookup(disk, lbas[i]) != NULL) {
+			continue;
+		}
+		bool hit;
+		struct buffer_head *bh = bcache_get(disk, lbas[i], &hit);
+		// bcache_get期间可能释放过锁,其他任务已读入
+		if(hit) {
+			continue;
+		}
+		bcache_submit(bh, false, bcache_prefetch_done, NULL);
+	}
+	lock_release(&bcache_lock);
+}
+
+// 写回所有脏缓冲区
+void bcache_flush(void) {
+	lock_acquire(&bcache_lock);
+	bcache_flush_locked();
+	lock_release(&bcache_lock);
+}
+
+// 立即写回硬盘disk上从lba开始的count个扇区中的脏缓冲区,返回时已写到硬盘
+// 用于必须先于其他修改落盘的元数据
+void bcache_sync(struct disk *disk, uint32_t lba, uint32_t count) {
+	lock_acquire(&bcache_lock);
+	bcache_writeback_locked(disk, lba, lba + count);
+	lock_release(&bcache_lock);
+}
+
+// 回写线程,定期写回脏缓冲区
+static void bcache_flusher(__attribute__((unused)) void *arg) {
+	while(1) {
+		sleep(BCACHE_FLUSH_INTERVAL);
+		bcache_flush();
+	}
+}
+
+// 初始化缓冲区缓存
+void bcache_init(void) {
+	uint8_t *data = get_kernel_pages(BCACHE_BUFFERS * 512 / PAGE_SIZE);
+	ASSERT(data != NULL);
+	for(uint32_t i = 0; i < BCACHE_HASH_SIZE; i++) {
+		list_init(&hash_table[i]);
+	}
+	list_init(&lru_list);
+	for(uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+		buffers[i].disk = NULL;
+		buffers[i].data = data + i * 512;
+		buffers[i].dirty = false;
+		buffers[i].busy = false;
+		buffers[i].pin_count = 0;
+		buffers[i].bio.private = &buffers[i];
+		list_append(&lru_list, &buffers[i].lru_tag);
+	}
+	lock_init(&bcache_lock);
+	lock_init(&flush_lock);
+	dirty_count = 0;
+	thread_start("bflush", 31, bcache_flusher, NULL);
+	printk("bcache_init done\n");
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,40 @@
+#ifndef __BCACHE_H
+#define __BCACHE_H
+
+#include "types.h"
+#include "list.h"
+#include "ide.h"
+
+#define BCACHE_BUFFERS 256 // 缓冲区数,每个缓冲区缓存一个扇区
+#define BCACHE_HASH_SIZE 64 // 散列表的桶数
+#define BCACHE_BATCH 8 // 读入时一次提交的扇区数
+#define BCACHE_DIRTY_LIMIT (BCACHE_BUFFERS / 2) // 脏缓冲区超过此数时立即回写
+#define BCACHE_FLUSH_INTERVAL 5000 // 回写线程的周期(毫秒)
+#define BCACHE_PREFETCH_MAX 32 // 一次预读的最大扇区数
+
+// 扇区缓冲区
+struct buffer_head {
+	struct disk *disk; // 所属硬盘,NULL表示未使用
+	uint32_t lba; // 扇区号
+	void *data; // 扇区内容,在直接映射区中,可以DMA
+	bool dirty; // 被写过且还未写回硬盘
+	bool busy; // 正在与硬盘传输,期间不能读写内容
+	uint32_t pin_count; // 正在使用它的任务数
+	struct bio bio; // 读写这个缓冲区用的bio,同一时刻只有一个传输
+	struct list_ele hash_tag; // 散列桶中的标记
+	struct list_ele lru_tag; // lru_list中的标记
+};
+
+void bcache_init(void);
+
+void bcache_read(struct disk *disk, uint32_t lba, void *buf, uint32_t count);
+
+void bcache_write(struct disk *disk, uint32_t lba, void *buf, uint32_t count);
+
+void bcache_flush(void);
+
+void bcache_sync(struct disk *disk, uint32_t lba, uint32_t count);
+
+void bcache_prefetch(struct disk *disk, uint32_t *lbas, uint32_t count);
+
+#endif
\ No newline at end of file
@@ -2,6 +2,124 @@
 #include "string.h"
 #include "debug.h"
 
+#define WORD_BITS 32 // 每次扫描的位数
+
+// 返回word中最低的1所在的位,word不能为0
+static inline uint32_t bit_scan_forward(uint32_t word) {
+	uint32_t index;
+	__asm__ __volatile__("bsf %1, %0" : "=r"(index) : "rm"(word));
+	return index;
+}
+
+// 读取位图的第w个32位字,超出byte_len的位视为1
+static uint32_t load_word(struct bitmap *btmp, uint32_t w) {
+	uint32_t byte_idx = w * 4;
+	if(byte_idx + 4 <= btmp->byte_len) {
+		return *((uint32_t*) (btmp->bits + byte_idx));
+	}
+	// 最后不足4字节的部分逐字节读取,避免越界访问
+	uint32_t word = 0xffffffff;
+	for(uint32_t i = 0; byte_idx + i < btmp->byte_len; i++) {
+		word &= ~(0xffU << (i * 8));
+		word |= (uint32_t) btmp->bits[byte_idx + i] << (i * 8);
+	}
+	return word;
+}
+
+// 根据第w个字是否已满更新摘要层
+static void update_summary(struct bitmap *btmp, uint32_t w) {
+	uint32_t bit = 1U << (w % WORD_BITS);
+	if(load_word(btmp, w) == 0xffffffff) {
+		btmp->summary[w / WORD_BITS] |= bit;
+	} else {
+		btmp->summary[w / WORD_BITS] &= ~bit;
+	}
+}
+
+// 将第w个字中mask对应的位设为value
+static void store_word(struct bitmap *btmp, uint32_t w, uint32_t mask, uint8_t value) {
+	uint32_t byte_idx = w * 4;
+	if(byte_idx + 4 <= btmp->byte_len) {
+		uint32_t *word = (uint32_t*) (btmp->bits + byte_idx);
+		if(value) {
+			*word |= mask;
+		} else {
+			*word &= ~mask;
+		}
+	} else {
+		for(uint32_t i = 0; byte_idx + i < btmp->byte_len; i++) {
+			uint8_t byte_mask = (uint8_t) (mask >> (i * 8));
+			if(value) {
+				btmp->bits[byte_idx + i] |= byte_mask;
+			} else {
+				btmp->bits[byte_idx + i] &= ~byte_mask;
+			}
+		}
+	}
+	if(btmp->summary != NULL) {
+		update_summary(btmp, w);
+	}
+}
+
+// 查找[from, end)中第一个为0的位,没有则返回end
+static uint32_t find_next_zero(struct bitmap *btmp, uint32_t from, uint32_t end) {
+	while(from < end) {
+		uint32_t w = from / WORD_BITS;
+		if(btmp->summary != NULL) {
+			// 借助摘要层一次跳过已满的字,w之前的字视为已满
+			uint32_t s_idx = w / WORD_BITS;
+			uint32_t s = btmp->summary[s_idx] | ((1U << (w % WORD_BITS)) - 1);
+			if(s == 0xffffffff) {
+				from = (s_idx + 1) * WORD_BITS * WORD_BITS;
+				continue;
+			}
+			uint32_t next_w = s_idx * WORD_BITS + bit_scan_forward(~s);
+			if(next_w != w) {
+				w = next_w;
+				from = w * WORD_BITS;
+				if(from >= end) {
+					break;
+				}
+			}
+		}
+		// 低于from的位视为已占用
+		uint32_t word = load_word(btmp, w) | ((1U << (from % WORD_BITS)) - 1);
+		if(word != 0xffffffff) {
+			uint32_t index = w * WORD_BITS + bit_scan_forward(~word);
+			return index < end ? index : end;
+		}
+		from = (w + 1) * WORD_BITS;
+	}
+	return end;
+}
+
+// 查找[from, end)中第一个为1的位,没有则返回end
+static uint32_t find_next_one(struct bitmap *btmp, uint32_t from, uint32_t end) {
+	while(from < end) {
+		uint32_t w = from / WORD_BITS;
+		uint32_t word = load_word(btmp, w) & ~((1U << (from % WORD_BITS)) - 1);
+		if(word != 0) {
+			uint32_t index = w * WORD_BITS + bit_scan_forward(word);
+			return index < end ? index : end;
+		}
+		from = (w + 1) * WORD_BITS;
+	}
+	return end;
+}
+
+// 在[start, end)中查找连续count个为0的位,成功返回起始索引,失败返回-1
+static int find_zero_run(struct bitmap *btmp, uint32_t start, uint32_t end, uint32_t count) {
+	uint32_t index = find_next_zero(btmp, start, end);
+	while(index + count <= end) {
+		uint32_t next = find_next_one(btmp, index, index + count);
+		if(next == index + count) {
+			return index;
+		}
+		index = find_next_zero(btmp, next, end);
+	}
+	return -1;
+}
+
 // 测试index位置的位是否为1,若为1返回true,否则返回false
 bool test_bitmap(struct bitmap *btmp, uint32_t index) {
 	ASSERT(btmp != NULL);
@@ -13,56 +131,65 @@ bool test_bitmap(struct bitmap *btmp, uint32_t index) {
 // 设置index位置的位为value
 void set_bitmap(struct bitmap *btmp, uint32_t index, uint8_t value) {
 	ASSERT(btmp != NULL && (value == 0 || value == 1));
-	uint32_t byte_idx = index / 8;
-	uint32_t bit_idx = index % 8;
-	if(value) {
-		btmp->bits[byte_idx] |= (value << bit_idx);
-	} else {
-		btmp->bits[byte_idx] &= ~(1 << bit_idx);
+	ASSERT(index / 8 < btmp->byte_len);
+	store_word(btmp, index / WORD_BITS, 1U << (index % WORD_BITS), value);
+}
+
+// 将从index开始的count个位设置为value
+void set_bitmap_range(struct bitmap *btmp, uint32_t index, uint32_t count, uint8_t value) {
+	ASSERT(btmp != NULL && (value == 0 || value == 1));
+	ASSERT(index + count <= btmp->byte_len * 8);
+	while(count > 0) {
+		uint32_t offset = index % WORD_BITS;
+		uint32_t n = WORD_BITS - offset;
+		if(n > count) {
+			n = count;
+		}
+		uint32_t mask = (n == WORD_BITS) ? 0xffffffff : (((1U << n) - 1) << offset);
+		store_word(btmp, index / WORD_BITS, mask, value);
+		index += n;
+		count -= n;
 	}
 }
 
 // 分配连续count个位,成功返回位图的索引,失败返回-1
+// 从上次分配结束的位置开始查找,到末尾后再从头查找
 int alloc_bitmap(struct bitmap *btmp, uint32_t count) {
-	ASSERT(btmp != NULL);
-	// 1 先找到空闲字节
-	uint32_t byte_idx = 0;
-	while((byte_idx < btmp->byte_len) && (0xff == btmp->bits[byte_idx])) {
-		++byte_idx;
+	ASSERT(btmp != NULL && count > 0);
+	uint32_t bit_len = btmp->byte_len * 8;
+	uint32_t hint = btmp->hint < bit_len ? btmp->hint : 0;
+	int index = find_zero_run(btmp, hint, bit_len, count);
+	if(index == -1 && hint > 0) {
+		uint32_t end = hint + count - 1;
+		index = find_zero_run(btmp, 0, end < bit_len ? end : bit_len, count);
 	}
-	if(byte_idx >= btmp->byte_len) {
+	if(index == -1) {
 		return -1;
 	}
-	// 2 再在空闲字节找到空闲位
-	uint32_t bit_idx = 0;
-	while((btmp->bits[byte_idx] >> bit_idx) & 0x01) {
-		++bit_idx;
-	}
-	// 3 寻找空闲位数目
-	uint32_t index = byte_idx * 8 + bit_idx; // 位图的索引
-	uint32_t avail_count = btmp->byte_len * 8 - index;
-	uint32_t find_count = 0;
-	uint32_t next_idx = index;
-	while(avail_count) {
-		if(!test_bitmap(btmp, next_idx)) {
-			++find_count;
-		} else {
-			find_count = 0;
-		}
-		if(find_count == count) {
-			for(uint32_t i = 0; i < count; i++) {
-				set_bitmap(btmp, (next_idx - count + 1) + i, 1);
-			}
-			return next_idx - count + 1;
-		}
-		++next_idx;
-		--avail_count;
-	}
-	return -1;
+	set_bitmap_range(btmp, index, count, 1);
+	btmp->hint = index + count;
+	return index;
 }
 
 // 初始化位图
 void init_bitmap(struct bitmap *btmp) {
 	ASSERT(btmp != NULL);
 	memset(btmp->bits, 0, btmp->byte_len);
-}
\ No newline at end of file
+	btmp->hint = 0;
+	if(btmp->summary != NULL) {
+		init_bitmap_summary(btmp, btmp->summary);
+	}
+}
+
+// 为位图挂上摘要层并根据当前内容建立摘要
+// summary至少要有BITMAP_SUMMARY_SIZE(btmp->byte_len)字节
+void init_bitmap_summary(struct bitmap *btmp, uint32_t *summary) {
+	ASSERT(btmp != NULL && summary != NULL);
+	uint32_t word_count = (btmp->byte_len + 3) / 4;
+	// 不存在的字标记为已满
+	memset(summary, 0xff, BITMAP_SUMMARY_SIZE(btmp->byte_len));
+	btmp->summary = summary;
+	for(uint32_t w = 0; w < word_count; w++) {
+		update_summary(btmp, w);
+	}
+}
@@ -3,18 +3,27 @@
 
 #include "types.h"
 
+// 摘要层所需的字节数,每个32位字对应摘要中的1位
+#define BITMAP_SUMMARY_SIZE(byte_len) ((((byte_len) + 127) / 128) * 4)
+
 // 位图
 struct bitmap {
 	uint32_t byte_len; // 字节数组长度
 	uint8_t *bits; // 字节数组
+	uint32_t hint; // 下次分配开始查找的位置(next-fit)
+	uint32_t *summary; // 可选的摘要层,位为1表示对应的32位字已满,NULL表示不使用
 };
 
 bool test_bitmap(struct bitmap *btmp, uint32_t index);
 
 void set_bitmap(struct bitmap *btmp, uint32_t index, uint8_t value);
 
+void set_bitmap_range(struct bitmap *btmp, uint32_t index, uint32_t count, uint8_t value);
+
 int alloc_bitmap(struct bitmap *btmp, uint32_t count);
 
 void init_bitmap(struct bitmap *btmp);
 
+void init_bitmap_summary(struct bitmap *btmp, uint32_t *summary);
+
 #endif
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "string.h"
 #include "file.h"
 #include "print.h"
+#include "slab.h"
+#include "bcache.h"
 
 // 默认情况下操作的分区
 extern struct partition *cur_part;
@@ -12,6 +14,22 @@ extern struct partition *cur_part;
 // 根目录
 struct directory root_dir;
 
+// 目录结构的cache
+static struct kmem_cache *dir_cache;
+
+// 目录结构的构造函数,dir_buf只在dir_read中使用,无需每次清0
+static void dir_ctor(void *obj) {
+	struct directory *dir = (struct directory*) obj;
+	dir->inode = NULL;
+	dir->dir_pos = 0;
+}
+
+// 创建dir_cache
+void dir_cache_init(void) {
+	dir_cache = kmem_cache_create("directory", sizeof(struct directory), 0, dir_ctor);
+	ASSERT(dir_cache != NULL);
+}
+
 // 打开根目录
 void open_root_dir(struct partition *part) {
 	root_dir.inode = inode_open(part, part->sp_block->root_inode_no);
@@ -20,7 +38,11 @@ void open_root_dir(struct partition *part) {
 
 // 在分区part上打开inode编号为inode_no的目录并返回目录指针
 struct directory *dir_open(struct partition *part, uint32_t inode_no) {
-	struct directory *dir = (struct directory*) sys_malloc(sizeof(struct directory));
+	struct directory *dir = (struct directory*) kmem_cache_alloc(dir_cache);
+	if(dir == NULL) {
+		printk("dir_open : alloc memory failed!\n");
+		return NULL;
+	}
 	dir->inode = inode_open(part, inode_no);
 	dir->dir_pos = 0;
 	return dir;
@@ -31,7 +53,7 @@ struct directory *dir_open(struct partition *part, uint32_t inode_no) {
 bool search_dir_entry(struct partition *part, struct directory *dir, \
 	const char *name, struct dir_entry *dir_ent) {
 	uint32_t block_count = 140; // 12个直接块+128个一级间接块
-	uint32_t *all_blocks = (uint32_t*) sys_malloc(48 + 512);
+	uint32_t *all_blocks = (uint32_t*) kernel_malloc(48 + 512);
 	if(all_blocks == NULL) {
 		printk("search_dir_entry : alloc memory failed!\n");
 		return false;
@@ -43,12 +65,12 @@ bool search_dir_entry(struct partition *part, struct directory *dir, \
 	}
 	block_index = 0;
 	if(dir->inode->sectors[12] != 0) { // 有一级间接块表
-		ide_read(part->disk, dir->inode->sectors[12], all_blocks + 12, 1);
+		bcache_read(part->disk, dir->inode->sectors[12], all_blocks + 12, 1);
 	}
 	// 此时,all_blocks存储的是该文件或目录的所有扇区地址
 	// 写目录项的时候已保证目录项不跨扇区,
 	// 只申请1个扇区的内存
-	uint8_t *buf = (uint8_t*) sys_malloc(SECTOR_SIZE);
+	uint8_t *buf = (uint8_t*) kernel_malloc(SECTOR_SIZE);
 	struct dir_entry *p_dir_ent = (struct dir_entry*) buf;
 	uint32_t dir_entry_size = part->sp_block->dir_entry_size;
 	uint32_t dir_entry_count = SECTOR_SIZE / dir_entry_size; // 1扇区内可容纳的目录项个数
@@ -59,15 +81,15 @@ bool search_dir_entry(struct partition *part, struct directory *dir, \
 			++block_index;
 			continue;
 		}
-		ide_read(part->disk, all_blocks[block_index], buf, 1);
+		bcache_read(part->disk, all_blocks[block_index], buf, 1);
 		uint32_t dir_entry_index = 0;
 		// 遍历扇区中所有目录项
 		while(dir_entry_index < dir_entry_count) {
 			// 找到就直接复制整个目录项
 			if(!strcmp(p_dir_ent->filename, name)) {
 				memcpy(dir_ent, p_dir_ent, dir_entry_size);
-				sys_free(buf);
-				sys_free(all_blocks);
+				kernel_free(buf);
+				kernel_free(all_blocks);
 				return true;
 			}
 			++dir_entry_index;
@@ -77,8 +99,8 @@ bool search_dir_entry(struct partition *part, struct directory *dir, \
 		p_dir_ent = (struct dir_entry*) buf;
 		memset(buf, 0, SECTOR_SIZE);
 	}
-	sys_free(buf);
-	sys_free(all_blocks);
+	kernel_free(buf);
+	kernel_free(all_blocks);
 	return false;
 }
 
@@ -89,7 +111,7 @@ void dir_close(struct directory *dir) {
 		return;
 	}
 	inode_close(dir->inode);
-	sys_free(dir);
+	kmem_cache_free(dir_cache, dir);
 }
 
 // 在内存中初始化目录项dir_ent
@@ -158,27 +180,27 @@ bool sync_dir_entry(struct directory *parent_dir, \
 				bitmap_sync(cur_part, block_btmp_index, BLOCK_BITMAP);
 				all_blocks[12] = block_lba;
 				// 把新分配的第0个间接块地址写入一级间接块表
-				ide_write(cur_part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
+				bcache_write(cur_part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
 			} else { // 间接块未分配
 				all_blocks[block_index] = block_lba;
 				// 把新分配的第(block_index - 12)个间接块地址写入一级间接块表
-				ide_write(cur_part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
+				bcache_write(cur_part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
 			}
 			// 再将新目录项p_dir_ent写入新分配的间接块
 			memset(io_buf, 0, 512);
 			memcpy(io_buf, dir_ent, dir_entry_size);
-			ide_write(cur_part->disk, all_blocks[block_index], io_buf, 1);
+			bcache_write(cur_part->disk, all_blocks[block_index], io_buf, 1);
 			dir_inode->i_size += dir_entry_size;
 			return true;
 		}
 		// 若第block_index块已存在,将其读进内存,然后在该块查找空目录项
-		ide_read(cur_part->disk, all_blocks[block_index], io_buf, 1);
+		bcache_read(cur_part->disk, all_blocks[block_index], io_buf, 1);
 		// 在扇区内查找空目录项
 		for(uint8_t dir_entry_index = 0; dir_entry_index < dir_entry_count; dir_entry_index++) {
 			if((p_dir_ent + dir_entry_index)->f_type == FT_UNKNOWN) {
 				// 无论是初始化或删除文件后,都将f_type置为FT_UNKNOWN
 				memcpy(p_dir_ent + dir_entry_index, dir_ent, dir_entry_size);
-				ide_write(cur_part->disk, all_blocks[block_index], io_buf, 1);
+				bcache_write(cur_part->disk, all_blocks[block_index], io_buf, 1);
 				dir_inode->i_size += dir_entry_size;
 				return true;
 			}
@@ -201,7 +223,7 @@ bool delete_dir_entry(struct partition *part, struct directory *dir, \
 		++block_index;
 	}
 	if(dir_inode->sectors[12]) {
-		ide_read(part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
+		bcache_read(part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
 	}
 	// 目录项在存储时保证不会跨扇区
 	uint32_t dir_entry_size = part->sp_block->dir_entry_size;
@@ -223,7 +245,7 @@ bool delete_dir_entry(struct partition *part, struct directory *dir, \
 		dir_entry_index = dir_entry_cnt = 0;
 		memset(io_buf, 0, SECTOR_SIZE);
 		// 读取扇区,获得目录项
-		ide_read(part->disk, all_blocks[block_index], io_buf, 1);
+		bcache_read(part->disk, all_blocks[block_index], io_buf, 1);
 		// 遍历所有的目录项
 		// 统计该扇区的目录项数量和是否有待删除的目录项
 		while(dir_entry_index < dir_entry_count) {
@@ -275,7 +297,7 @@ bool delete_dir_entry(struct partition *part, struct directory *dir, \
 				ASSERT(indirect_blocks >= 1);
 				if(indirect_blocks > 1) {
 					all_blocks[block_index] = 0;
-					ide_write(part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
+					bcache_write(part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
 				} else {
 					// 间接索引表就当前1个间接块
 					// 直接回收所在块,然后擦除间接索引表块地址
@@ -289,7 +311,7 @@ bool delete_dir_entry(struct partition *part, struct directory *dir, \
 			}
 		} else { // 仅将该目录项清空
 			memset(dir_ent_found, 0, dir_entry_size);
-			ide_write(part->disk, all_blocks[block_index], io_buf, 1);
+			bcache_write(part->disk, all_blocks[block_index], io_buf, 1);
 		}
 		// 更新inode信息并同步到硬盘
 		ASSERT(dir_inode->i_size >= dir_entry_size);
@@ -315,7 +337,7 @@ struct dir_entry *dir_read(struct directory *dir) {
 		++block_index;
 	}
 	if(dir_inode->sectors[12] != 0) { // 有一级间接块表
-		ide_read(cur_part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
+		bcache_read(cur_part->disk, dir_inode->sectors[12], all_blocks + 12, 1);
 		block_count = 140;
 	}
 	block_index = 0;
@@ -335,7 +357,7 @@ struct dir_entry *dir_read(struct directory *dir) {
 			continue;
 		}
 		memset(dir_ent, 0, SECTOR_SIZE);
-		ide_read(cur_part->disk, all_blocks[block_index], dir_ent, 1);
+		bcache_read(cur_part->disk, all_blocks[block_index], dir_ent, 1);
 		dir_entry_index = 0;
 		// 遍历扇区内所有目录项
 		while(dir_entry_index < dir_entry_count) {
@@ -375,7 +397,7 @@ int32_t dir_remove(struct directory *parent_dir, struct directory *child_dir) {
 		ASSERT(child_dir_inode->sectors[block_index] == 0);
 		++block_index;
 	}
-	void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+	void *io_buf = kernel_malloc(SECTOR_SIZE * 2);
 	if(io_buf == NULL) {
 		printk("dir_remove : alloc memory failed!\n");
 		return -1;
@@ -385,7 +407,7 @@ int32_t dir_remove(struct directory *parent_dir, struct directory *child_dir) {
 	// 回收inode中sectors所占用的扇区
 	// 同步inode_btmp和block_btmp
 	inode_release(cur_part, child_dir_inode->i_no);
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	return 0;
 }
 
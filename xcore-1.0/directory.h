@@ -18,6 +18,8 @@ struct dir_entry {
 	enum file_type f_type; // 文件类型
 };
 
+void dir_cache_init(void);
+
 void open_root_dir(struct partition *part);
 
 struct directory *dir_open(struct partition *part, uint32_t inode_no);
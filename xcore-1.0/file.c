@@ -7,11 +7,16 @@
 #include "string.h"
 #include "interrupt.h"
 #include "ide.h"
+#include "bcache.h"
 #include "debug.h"
+#include "slab.h"
 
 // 默认情况下操作的分区
 extern struct partition *cur_part;
 
+// 内存中inode的cache,定义在inode.c
+extern struct kmem_cache *inode_cache;
+
 // 文件表
 struct file file_table[MAX_FILE_OPEN];
 
@@ -67,32 +72,63 @@ int32_t alloc_block_bitmap(struct partition *part) {
 	return part->sp_block->data_lba_start + bit_index;
 }
 
-// 将内存中bitmap第bit_index位所在的512字节同步到硬盘
+// 将内存中bitmap第bit_index位所在的512字节标记为待写回
+// 一次操作中多次修改同一扇区只写回一次,由bitmap_flush在操作结束时写回
 void bitmap_sync(struct partition *part, uint32_t bit_index, enum bitmap_type btmp_type) {
 	uint32_t sector_offset = bit_index / 4096;
-	uint32_t offset_size = sector_offset * BLOCK_SIZE;
-	uint32_t sector_lba;
-	uint8_t *btmp_offset;
 	// 需要被同步到硬盘的位图只有inode_btp和block_btmp
 	switch(btmp_type) {
 		case INODE_BITMAP:
-			sector_lba = part->sp_block->inode_btmp_lba + sector_offset;
-			btmp_offset = part->inode_btmp.bits + offset_size;
+			set_bitmap(&part->inode_btmp_dirty, sector_offset, 1);
 			break;
 		case BLOCK_BITMAP:
-			sector_lba = part->sp_block->block_btmp_lba + sector_offset;
-			btmp_offset = part->block_btmp.bits + offset_size;
+			set_bitmap(&part->block_btmp_dirty, sector_offset, 1);
 			break;
 	}
-	ide_write(part->disk, sector_lba, btmp_offset, 1);
+}
+
+// 写回位图btmp中在dirty里标记的扇区,btmp_lba是位图在硬盘上的起始扇区
+// sync为true时直接写到硬盘,否则只写入缓冲区缓存
+static void bitmap_flush_dirty(struct partition *part, struct bitmap *btmp, \
+	struct bitmap *dirty, uint32_t btmp_lba, bool sync) {
+	uint32_t sectors = btmp->byte_len / BLOCK_SIZE;
+	uint32_t sector = 0;
+	while(sector < sectors) {
+		if(!test_bitmap(dirty, sector)) {
+			++sector;
+			continue;
+		}
+		// 相邻的脏扇区合并为一次写
+		uint32_t count = 1;
+		while(sector + count < sectors && test_bitmap(dirty, sector + count)) {
+			++count;
+		}
+		bcache_write(part->disk, btmp_lba + sector, btmp->bits + sector * BLOCK_SIZE, count);
+		if(sync) {
+			bcache_sync(part->disk, btmp_lba + sector, count);
+		}
+		set_bitmap_range(dirty, sector, count, 0);
+		sector += count;
+	}
+}
+
+// 写回分区part的位图中被bitmap_sync标记的扇区
+// 缓冲区缓存按扇区号批量写回,不保证先后,故需要顺序时由sync决定:
+// 分配时sync为true,位图先于之后才写入缓存的inode落盘;
+// 释放时调用者先用bcache_flush让不再引用这些块的目录项和inode落盘,再以sync为false调用
+void bitmap_flush(struct partition *part, bool sync) {
+	bitmap_flush_dirty(part, &part->inode_btmp, &part->inode_btmp_dirty, \
+		part->sp_block->inode_btmp_lba, sync);
+	bitmap_flush_dirty(part, &part->block_btmp, &part->block_btmp_dirty, \
+		part->sp_block->block_btmp_lba, sync);
 }
 
 // 创建文件,若成功则返回文件描述符,否则返回-1
 int32_t file_create(struct directory *parent_dir, char *filename, uint8_t flag) {
 	// 后续操作的公共缓冲区
-	void *io_buf = sys_malloc(1024);
+	void *io_buf = kernel_malloc(1024);
 	if(io_buf == NULL) {
-		printk("file_create : sys_malloc failed!\n");
+		printk("file_create : kernel_malloc failed!\n");
 		return -1;
 	}
 	uint8_t rollback_flag = 0; // 用于操作失败时回滚各资源状态
@@ -102,11 +138,11 @@ int32_t file_create(struct directory *parent_dir, char *filename, uint8_t flag)
 		printk("file_create : alloc_inode_bitmap failed!\n");
 		return -1;
 	}
-	// 此inode要从堆中申请内存,不可生成局部变量(函数退出时会释放)
+	// 此inode要从inode_cache中申请,不可生成局部变量(函数退出时会释放)
 	// 因为file_table数组中的文件描述符的inode指针要指向它
-	struct inode *new_inode = (struct inode*) sys_malloc(sizeof(struct inode));
+	struct inode *new_inode = (struct inode*) kmem_cache_alloc(inode_cache);
 	if(new_inode == NULL) {
-		printk("fil_create : sys_malloc failed!\n");
+		printk("file_create : kmem_cache_alloc failed!\n");
 		rollback_flag = 1;
 		goto rollback;
 	}
@@ -120,6 +156,10 @@ int32_t file_create(struct directory *parent_dir, char *filename, uint8_t flag)
 	file_table[fd_index].fd_inode = new_inode;
 	file_table[fd_index].fd_pos = 0;
 	file_table[fd_index].fd_flag = flag;
+	file_table[fd_index].fd_refs = 1;
+	file_table[fd_index].ra_last = FILE_RA_NONE;
+	file_table[fd_index].ra_end = 0;
+	file_table[fd_index].ra_window = 0;
 	file_table[fd_index].fd_inode->write_flag = false;
 	struct dir_entry new_dir_entry;
 	memset(&new_dir_entry, 0, sizeof(struct dir_entry));
@@ -132,18 +172,19 @@ int32_t file_create(struct directory *parent_dir, char *filename, uint8_t flag)
 		rollback_flag = 3;
 		goto rollback;
 	}
+	// 2 将inode_btmp位图和sync_dir_entry分配的块一起写到硬盘,先于引用它们的inode
+	bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+	bitmap_flush(cur_part, true);
 	memset(io_buf, 0, 1024);
-	// 2 将父目录inode的内容同步到硬盘
+	// 3 将父目录inode的内容同步到硬盘
 	inode_sync(cur_part, parent_dir->inode, io_buf);
 	memset(io_buf, 0, 1024);
-	// 3 将新创建文件的inode内容同步到硬盘
+	// 4 将新创建文件的inode内容同步到硬盘
 	inode_sync(cur_part, new_inode, io_buf);
-	// 4 将inode_btmp位图同步到硬盘
-	bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 	// 5 将创建的文件inode添加到open_inodes链表
 	list_push(&cur_part->open_inodes, &new_inode->inode_tag);
 	new_inode->open_count = 1;
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	return install_task_fd(fd_index);
 rollback:
 	switch(rollback_flag) {
@@ -151,14 +192,14 @@ rollback:
 			// 失败时,将file_table中的相应位清空
 			memset(&file_table[fd_index], 0, sizeof(struct file));
 		case 2:
-			sys_free(new_inode);
+			kmem_cache_free(inode_cache, new_inode);
 		case 1:
 			// 如果新文件的inode创建失败,
 			// 之前位图中分配的inode_no也要恢复
 			set_bitmap(&cur_part->inode_btmp, inode_no, 0);
 			break;
 	}
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	return -1;
 }
 
@@ -174,6 +215,10 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
 	// 每次打开文件,要将fd_pos还原为0,即让文件内的指针指向开头
 	file_table[fd_index].fd_pos = 0;
 	file_table[fd_index].fd_flag = flag;
+	file_table[fd_index].fd_refs = 1;
+	file_table[fd_index].ra_last = FILE_RA_NONE;
+	file_table[fd_index].ra_end = 0;
+	file_table[fd_index].ra_window = 0;
 	bool *write_flag = &file_table[fd_index].fd_inode->write_flag;
 	if((flag == FO_WRITEONLY) || (flag == FO_READWRITE)) {
 		enum intr_status old_status = get_intr_status();
@@ -184,6 +229,9 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
 		} else { // 写文件失败
 			set_intr_status(old_status);
 			printk("file is being occupied,try again later!\n");
+			// 归还已打开的inode和文件结构
+			inode_close(file_table[fd_index].fd_inode);
+			file_table[fd_index].fd_inode = NULL;
 			return -1;
 		}
 	}
@@ -195,6 +243,10 @@ int32_t file_close(struct file *file) {
 	if(file == NULL) {
 		return -1;
 	}
+	// 还有其他进程的文件描述符指向此文件结构时只减少引用数
+	if(--file->fd_refs > 0) {
+		return 0;
+	}
 	file->fd_inode->write_flag = false;
 	inode_close(file->fd_inode);
 	file->fd_inode = NULL; // 使文件结构可用
@@ -209,13 +261,13 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 		printk("exceed max file size 71680 byte, write file failed!\n");
 		return -1;
 	}
-	uint8_t *io_buf = sys_malloc(BLOCK_SIZE);
+	uint8_t *io_buf = kernel_malloc(BLOCK_SIZE);
 	if(io_buf == NULL) {
 		printk("file_write : alloc io_buf memory failed!\n");
 		return -1;
 	}
 	// 文件的所有块的地址
-	uint32_t *all_blocks =  (uint32_t*) sys_malloc(BLOCK_SIZE + 48);
+	uint32_t *all_blocks =  (uint32_t*) kernel_malloc(BLOCK_SIZE + 48);
 	if(all_blocks == NULL) {
 		printk("file_write : alloc all_blocks memory failed!\n");
 		return -1;
@@ -264,7 +316,7 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 			// 未写入新数据之前已经占用了间接块,需要将间接块地址读进来
 			ASSERT(file->fd_inode->sectors[12] != 0);
 			indirect_block_table = file->fd_inode->sectors[12];
-			ide_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 		}
 	} else {
 		// 若有增量,便涉及到分配新扇区及是否分配一级间接块表
@@ -333,7 +385,7 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 				++block_index; // 下一个新扇区
 			}
 			// 同步一级间接块表到硬盘
-			ide_write(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_write(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 		}  else if(file_has_used_blocks > 12) {
 			// 第三种情况 : 新数据占据间接块
 			// 已经具备了一级间接块表
@@ -341,7 +393,7 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 			// 获取一级间接表地址
 			indirect_block_table = file->fd_inode->sectors[12];
 			// 已使用的间接块已将被读入all_blocks,无需单独收录
-			ide_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 			// 第一个未使用的间接块,即已使用的间接块的下一块
 			block_index = file_has_used_blocks;
 			while(block_index < file_will_use_blocks) {
@@ -356,7 +408,7 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 				bitmap_sync(cur_part, block_btmp_index, BLOCK_BITMAP);
 			}
 			// 同步一级间接块表到硬盘
-			ide_write(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_write(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 		}
 	}
 	// 用到的块地址已经收集到all_blocks中,下面开始写数据
@@ -372,11 +424,11 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 		// 判断此次写入硬盘的数据大小
 		chunk_size = left_bytes < sector_left_bytes ? left_bytes : sector_left_bytes;
 		if(first_write_block) {
-			ide_read(cur_part->disk, sector_lba, io_buf, 1);
+			bcache_read(cur_part->disk, sector_lba, io_buf, 1);
 			first_write_block =false;
 		}
 		memcpy(io_buf + sector_offset_bytes, src, chunk_size);
-		ide_write(cur_part->disk, sector_lba, io_buf, 1);
+		bcache_write(cur_part->disk, sector_lba, io_buf, 1);
 		printk("file write at lba %x\n", sector_lba); // 调试
 		src += chunk_size; // 将指针移到下一个新数据
 		file->fd_inode->i_size += chunk_size; // 更新文件大小
@@ -384,12 +436,60 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count) {
 		written_bytes += chunk_size;
 		left_bytes -= chunk_size;
 	}
+	// 新分配的块在位图中的修改一起写到硬盘,先于引用它们的inode
+	bitmap_flush(cur_part, true);
 	inode_sync(cur_part, file->fd_inode, io_buf);
-	sys_free(all_blocks);
-	sys_free(io_buf);
+	kernel_free(all_blocks);
+	kernel_free(io_buf);
 	return written_bytes;
 }
 
+// 根据本次读取的块范围[start, end]更新file的预读状态
+// 顺序读越过已预读的范围时,从start起预读ra_window块,窗口每次加倍,随机读时窗口归0
+// all_blocks中已有[start, end]的块地址,间接块表只在end >= 12时已读入
+static void file_readahead(struct file *file, uint32_t *all_blocks, uint32_t start, uint32_t end) {
+	bool sequential = (start == file->ra_last || start == file->ra_last + 1);
+	file->ra_last = end;
+	if(!sequential) {
+		file->ra_window = 0;
+		file->ra_end = 0;
+		return;
+	}
+	if(end < file->ra_end) { // 仍在已预读的范围内
+		return;
+	}
+	if(file->ra_window == 0) {
+		file->ra_window = FILE_RA_MIN;
+	} else if(file->ra_window < FILE_RA_MAX) {
+		file->ra_window *= 2;
+	}
+	uint32_t ra_start = (start > file->ra_end ? start : file->ra_end);
+	uint32_t ra_stop = start + file->ra_window;
+	uint32_t file_blocks = DIV_ROUND_UP(file->fd_inode->i_size, BLOCK_SIZE);
+	if(ra_stop > file_blocks) {
+		ra_stop = file_blocks;
+	}
+	if(ra_stop > 140) { // 12个直接块 + 128个间接块
+		ra_stop = 140;
+	}
+	if(ra_stop > 12 && end < 12) {
+		ASSERT(file->fd_inode->sectors[12] != 0);
+		bcache_read(cur_part->disk, file->fd_inode->sectors[12], all_blocks + 12, 1);
+	}
+	uint32_t lbas[FILE_RA_MAX];
+	uint32_t count = 0;
+	for(uint32_t block_index = ra_start; block_index < ra_stop; block_index++) {
+		uint32_t lba = (block_index < 12 ? file->fd_inode->sectors[block_index] : all_blocks[block_index]);
+		if(lba != 0) {
+			lbas[count++] = lba;
+		}
+	}
+	if(count > 0) {
+		bcache_prefetch(cur_part->disk, lbas, count);
+	}
+	file->ra_end = ra_stop;
+}
+
 // 从文件file中读取count个字节写入buf,
 // 成功返回读出的字节数,若到文件尾则返回-1
 int32_t file_read(struct file *file, void *buf, uint32_t count) {
@@ -405,12 +505,12 @@ int32_t file_read(struct file *file, void *buf, uint32_t count) {
 			return -1;
 		}
 	}
-	uint8_t *io_buf = (uint8_t*) sys_malloc(BLOCK_SIZE);
+	uint8_t *io_buf = (uint8_t*) kernel_malloc(BLOCK_SIZE);
 	if(io_buf == NULL) {
 		printk("file_read : alloc memory failed!\n");
 		return -1;
 	}
-	uint32_t *all_blocks = (uint32_t*) sys_malloc(BLOCK_SIZE + 48);
+	uint32_t *all_blocks = (uint32_t*) kernel_malloc(BLOCK_SIZE + 48);
 	// 用来记录文件所有的块地址
 	if(all_blocks == NULL) {
 		printk("file_read : alloc_memory failed!\n");
@@ -432,7 +532,7 @@ int32_t file_read(struct file *file, void *buf, uint32_t count) {
 			all_blocks[block_index] = file->fd_inode->sectors[block_index];
 		} else { // 若用到一级间接块表,需要将表间接块读进来
 			indirect_block_table = file->fd_inode->sectors[12];
-			ide_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 		}
 	} else { // 跨扇区
 		// 第一种情况 : 起始块和结束块属于直接块
@@ -455,7 +555,7 @@ int32_t file_read(struct file *file, void *buf, uint32_t count) {
 			// 再将间接块地址写入all_blocks
 			indirect_block_table = file->fd_inode->sectors[12];
 			// 将一级间接块表读进来写入到第13块个块的位置之后
-			ide_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 		} else {
 			// 第三种情况 : 数据在间接块中
 			// 确保已经分配了一级间接块表
@@ -463,9 +563,11 @@ int32_t file_read(struct file *file, void *buf, uint32_t count) {
 			// 获取一级间接表地址
 			indirect_block_table = file->fd_inode->sectors[12];
 			// 将一级间接块表读进来写入到第13块个块的位置之后
-			ide_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
+			bcache_read(cur_part->disk, indirect_block_table, all_blocks + 12, 1);
 		}
 	}
+	// 顺序读时提交之后的块的读请求,不等待它们读完
+	file_readahead(file, all_blocks, block_read_start_index, block_read_end_index);
 	// 用到的块地址已经收集到all_blocks中,下面开始读数据
 	uint32_t sector_index;
 	uint32_t sector_lba;
@@ -481,15 +583,15 @@ int32_t file_read(struct file *file, void *buf, uint32_t count) {
 		// 待读入的数据大小
 		chunk_size = size_left < sector_left_bytes ? size_left : sector_left_bytes;
 		memset(io_buf, 0, BLOCK_SIZE); // 不清空也可以
-		ide_read(cur_part->disk, sector_lba, io_buf, 1);
+		bcache_read(cur_part->disk, sector_lba, io_buf, 1);
 		memcpy(buf_dst, io_buf + sector_offset_bytes, chunk_size);
 		buf_dst += chunk_size;
 		file->fd_pos += chunk_size;
 		bytes_read += chunk_size;
 		size_left -= chunk_size;
 	}
-	sys_free(all_blocks);
-	sys_free(io_buf);
+	kernel_free(all_blocks);
+	kernel_free(io_buf);
 	return bytes_read;
 }
 
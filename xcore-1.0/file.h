@@ -6,6 +6,9 @@
 #include "directory.h"
 
 #define MAX_FILE_OPEN 32 // 系统可打开的最大文件数
+#define FILE_RA_MIN 4 // 开始顺序读时的预读块数
+#define FILE_RA_MAX 32 // 预读块数的上限
+#define FILE_RA_NONE ((uint32_t) -1) // ra_last的初值,表示还未读过,从第0块开始读算作顺序读
 
 // 文件结构
 struct file {
@@ -13,6 +16,10 @@ struct file {
 	uint32_t fd_pos;
 	uint32_t fd_flag;
 	struct inode *fd_inode;
+	uint32_t fd_refs; // 引用此文件结构的文件描述符数,fork后父子进程共享
+	uint32_t ra_last; // 上次读到的最后一块,下次从这里或下一块开始读即为顺序读
+	uint32_t ra_end; // 已预读到的块(不含),顺序读越过它时再预读
+	uint32_t ra_window; // 预读窗口的块数,0表示未在预读
 };
 
 // 标准输入输出描述符
@@ -38,6 +45,8 @@ int32_t alloc_block_bitmap(struct partition *part);
 
 void bitmap_sync(struct partition *part, uint32_t bit_index, enum bitmap_type btmp);
 
+void bitmap_flush(struct partition *part, bool sync);
+
 int32_t file_create(struct directory *parent_dir, char *filename, uint8_t flag);
 
 int32_t file_open(uint32_t inode_no, uint8_t flag);
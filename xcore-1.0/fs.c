@@ -2,6 +2,7 @@
 #include "global.h"
 #include "print.h"
 #include "ide.h"
+#include "bcache.h"
 #include "memory.h"
 #include "string.h"
 #include "debug.h"
@@ -28,6 +29,18 @@ extern struct file file_table[MAX_FILE_OPEN];
 // 默认情况下操作的分区
 struct partition *cur_part;
 
+// 为有secs个扇区的位图建立脏扇区位图,每位对应一个扇区
+static void mount_dirty_bitmap(struct bitmap *dirty, uint32_t secs) {
+	// set_bitmap按32位字操作,长度取整到4字节
+	dirty->byte_len = DIV_ROUND_UP(secs, 32) * 4;
+	dirty->bits = (uint8_t*) kernel_malloc(dirty->byte_len);
+	if(dirty->bits == NULL) {
+		PANIC("alloc memory failed!");
+	}
+	dirty->summary = NULL;
+	init_bitmap(dirty);
+}
+
 // 分区挂载,在分区链表中找到名为part_name的分区,并将其指针赋值给cur_part
 static bool partition_mount(struct list_ele *ele, int arg) {
 	char *part_name = (char*) arg;
@@ -35,37 +48,46 @@ static bool partition_mount(struct list_ele *ele, int arg) {
 	if(!strcmp(part->name, part_name)) {
 		cur_part = part;
 		struct disk *disk = cur_part->disk;
-		struct super_block *sp_block = (struct super_block*) sys_malloc(SECTOR_SIZE);
+		struct super_block *sp_block = (struct super_block*) kernel_malloc(SECTOR_SIZE);
 		// 在内存中创建分区cur_part的超级块
-		cur_part->sp_block = (struct super_block*) sys_malloc(sizeof(struct super_block));
+		cur_part->sp_block = (struct super_block*) kernel_malloc(sizeof(struct super_block));
 		if(cur_part->sp_block == NULL) {
 			PANIC("alloc memory failed!");
 		}
 		// 读入超级块
 		memset(sp_block, 0, SECTOR_SIZE);
-		ide_read(disk, cur_part->lba_start + 1, sp_block, 1);
+		bcache_read(disk, cur_part->lba_start + 1, sp_block, 1);
 		// 把sp_block复制到分区的超级块中
 		memcpy(cur_part->sp_block, sp_block, sizeof(struct super_block));
 		// 将硬盘上的块位图读入到内存
 		cur_part->block_btmp.bits = (uint8_t*) \
-			sys_malloc(sp_block->block_btmp_secs * SECTOR_SIZE);
+			kernel_malloc(sp_block->block_btmp_secs * SECTOR_SIZE);
 		if(cur_part->block_btmp.bits == NULL) {
 			PANIC("alloc memory failed!");
 		}
 		cur_part->block_btmp.byte_len = sp_block->block_btmp_secs * SECTOR_SIZE;
 		// 从硬盘上读入块位图到分区的block_btmp.bits
-		ide_read(disk, sp_block->block_btmp_lba, cur_part->block_btmp.bits, \
+		bcache_read(disk, sp_block->block_btmp_lba, cur_part->block_btmp.bits, \
 			sp_block->block_btmp_secs);
+		// 块位图较大,建立摘要层以加快查找空闲块
+		uint32_t *summary = kernel_malloc(BITMAP_SUMMARY_SIZE(cur_part->block_btmp.byte_len));
+		if(summary == NULL) {
+			PANIC("alloc memory failed!");
+		}
+		init_bitmap_summary(&cur_part->block_btmp, summary);
 		// 将硬盘上的inode位图读入到内存
 		cur_part->inode_btmp.bits = (uint8_t*) \
-			sys_malloc(sp_block->inode_btmp_secs * SECTOR_SIZE);
+			kernel_malloc(sp_block->inode_btmp_secs * SECTOR_SIZE);
 		if(cur_part->inode_btmp.bits == NULL) {
 			PANIC("alloc memory failed!");
 		}
 		cur_part->inode_btmp.byte_len = sp_block->inode_btmp_secs * SECTOR_SIZE;
 		// 从硬盘上读入inode位图到分区的inode_btmp.bits
-		ide_read(disk, sp_block->inode_btmp_lba, cur_part->inode_btmp.bits, \
+		bcache_read(disk, sp_block->inode_btmp_lba, cur_part->inode_btmp.bits, \
 			sp_block->inode_btmp_secs);
+		// 位图的修改先记在脏扇区位图中,由bitmap_flush一起写回
+		mount_dirty_bitmap(&cur_part->block_btmp_dirty, sp_block->block_btmp_secs);
+		mount_dirty_bitmap(&cur_part->inode_btmp_dirty, sp_block->inode_btmp_secs);
 		list_init(&cur_part->open_inodes);
 		
 		printk("mount %s done!\n", part->name);
@@ -115,6 +137,7 @@ static void partition_format(struct partition *part) {
 		sp_block.inode_count, sp_block.block_btmp_lba, sp_block.block_btmp_secs, sp_block.inode_btmp_lba, \
 		sp_block.inode_btmp_secs, sp_block.inode_table_lba, sp_block.inode_table_secs, sp_block.data_lba_start);
 	
+	// 格式化在挂载之前,缓存中还没有本分区的扇区,故直接写硬盘
 	struct disk *disk = part->disk;
 	// 1 将超级块写入本分区的1扇区
 	ide_write(disk, part->lba_start + 1, &sp_block, 1);
@@ -124,7 +147,7 @@ static void partition_format(struct partition *part) {
 		sp_block.block_btmp_secs : sp_block.inode_btmp_secs);
 	buf_size = (buf_size >= sp_block.inode_table_secs ? buf_size : \
 		sp_block.inode_table_secs) * SECTOR_SIZE;
-	uint8_t *buf = (uint8_t*) sys_malloc(buf_size);
+	uint8_t *buf = (uint8_t*) kernel_malloc(buf_size);
 	// 2 将块位图初始化并写入sp_block.block_btmp_lba
 	buf[0] |= 0x01; // 第0个块预留给根目录,位图中先占位
 	uint32_t block_btmp_last_byte = block_btmp_bit_len / 8;
@@ -177,7 +200,7 @@ static void partition_format(struct partition *part) {
 	printk("root_dir_lba : %x\n", sp_block.data_lba_start);
 	printk("%s format done!\n", part->name);
 	
-	sys_free(buf);
+	kernel_free(buf);
 }
 
 // 将最上层路径名称解析出来
@@ -459,7 +482,7 @@ int32_t sys_unlink(const char *pathname) {
 	}
 	ASSERT(file_index == MAX_FILE_OPEN);
 	// 为delete_dir_entry申请缓冲区
-	void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+	void *io_buf = kernel_malloc(SECTOR_SIZE * 2);
 	if(io_buf == NULL) {
 		dir_close(path_record.parent_dir);
 		printk("sys_unlink : alloc memory failed!\n");
@@ -467,7 +490,7 @@ int32_t sys_unlink(const char *pathname) {
 	}
 	delete_dir_entry(cur_part, path_record.parent_dir, inode_no, io_buf);
 	inode_release(cur_part, inode_no);
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	dir_close(path_record.parent_dir);
 	return 0;
 }
@@ -475,7 +498,7 @@ int32_t sys_unlink(const char *pathname) {
 // 创建目录pathname,成功返回0,失败返回-1
 int32_t sys_mkdir(const char *pathname) {
 	uint8_t rollback_flag = 0; // 操作失败回滚标志
-	void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+	void *io_buf = kernel_malloc(SECTOR_SIZE * 2);
 	if(io_buf == NULL) {
 		printk("sys_mkdir : alloc memory failed!\n");
 		return -1;
@@ -538,7 +561,7 @@ int32_t sys_mkdir(const char *pathname) {
 	memcpy(p_dir_ent->filename, "..", 2);
 	p_dir_ent->i_no = parent_dir->inode->i_no;
 	p_dir_ent->f_type = FT_DIRECTORY;
-	ide_write(cur_part->disk, new_dir_inode.sectors[0], io_buf, 1);
+	bcache_write(cur_part->disk, new_dir_inode.sectors[0], io_buf, 1);
 	new_dir_inode.i_size = 2 * cur_part->sp_block->dir_entry_size;
 	// 在父目录添加自己的目录项
 	struct dir_entry new_dir_entry;
@@ -550,15 +573,16 @@ int32_t sys_mkdir(const char *pathname) {
 		rollback_flag = 2;
 		goto rollback;
 	}
+	// 将inode位图和新分配的块一起写到硬盘,先于引用它们的inode
+	bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+	bitmap_flush(cur_part, true);
 	// 父目录的inode同步到硬盘
 	memset(io_buf, 0, SECTOR_SIZE * 2);
 	inode_sync(cur_part, parent_dir->inode, io_buf);
 	// 将新创建目录的inode同步到硬盘
 	memset(io_buf, 0, SECTOR_SIZE * 2);
 	inode_sync(cur_part, &new_dir_inode, io_buf);
-	// 将inode位图同步到硬盘
-	bitmap_sync(cur_part, inode_no, INODE_BITMAP);
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	// 关闭所创建目录的父目录
 	dir_close(path_record.parent_dir);
 	return 0;
@@ -572,7 +596,7 @@ rollback:
 			dir_close(path_record.parent_dir);
 			break;
 	}
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	return -1;
 }
 
@@ -611,11 +635,17 @@ int32_t sys_closedir(struct directory *dir) {
 	return ret;
 }
 
-// 读取目录dir的一个目录项
-// 成功返回目录项地址,失败返回NULL
-struct dir_entry *sys_readdir(struct directory *dir) {
-	ASSERT(dir != NULL);
-	return dir_read(dir);
+// 读取目录dir的一个目录项并复制到dir_ent,
+// 目录结构位于内核空间,用户进程不能直接访问dir_buf
+// 成功返回dir_ent,失败返回NULL
+struct dir_entry *sys_readdir(struct directory *dir, struct dir_entry *dir_ent) {
+	ASSERT(dir != NULL && dir_ent != NULL);
+	struct dir_entry *ent = dir_read(dir);
+	if(ent == NULL) {
+		return NULL;
+	}
+	memcpy(dir_ent, ent, sizeof(struct dir_entry));
+	return dir_ent;
 }
 
 // 把目录dir的指针dir_pos置0
@@ -660,7 +690,7 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void *io_buf) {
 	uint32_t block_lba = child_dir_inode->sectors[0];
 	ASSERT(block_lba >= cur_part->sp_block->data_lba_start);
 	inode_close(child_dir_inode);
-	ide_read(cur_part->disk, block_lba, io_buf, 1);
+	bcache_read(cur_part->disk, block_lba, io_buf, 1);
 	struct dir_entry *dir_ent = (struct dir_entry*) io_buf;
 	// 第0个目录项是".",第1个目录项是".."
 	ASSERT(dir_ent[1].i_no < 4096 && dir_ent[1].f_type == FT_DIRECTORY);
@@ -683,7 +713,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, \
 	}
 	// 若包含一级间接块表,将其读入all_blocks
 	if(parent_dir_inode->sectors[12] != 0) {
-		ide_read(cur_part->disk, parent_dir_inode->sectors[12], all_blocks + 12, 1);
+		bcache_read(cur_part->disk, parent_dir_inode->sectors[12], all_blocks + 12, 1);
 		block_cnt = 140;
 	}
 	inode_close(parent_dir_inode);
@@ -694,7 +724,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, \
 	// 遍历所有块
 	while(block_index < block_cnt) {
 		if(all_blocks[block_index] != 0) { // 若相应块不为空,则读入相应块
-			ide_read(cur_part->disk, all_blocks[block_index], io_buf, 1);
+			bcache_read(cur_part->disk, all_blocks[block_index], io_buf, 1);
 			uint8_t dir_entry_index = 0;
 			// 遍历每个目录项
 			while(dir_entry_index < dir_entry_count) {
@@ -718,7 +748,7 @@ char *sys_getcwd(char *buf, uint32_t size) {
 	// 确保buf不为空,若用户进程提供的buf为NULL,
 	// 系统调用getcwd中要为用户进程通过malloc分配内存
 	ASSERT(buf != NULL);
-	void *io_buf = sys_malloc(SECTOR_SIZE);
+	void *io_buf = kernel_malloc(SECTOR_SIZE);
 	if(io_buf == NULL) {
 		return NULL;
 	}
@@ -743,7 +773,7 @@ char *sys_getcwd(char *buf, uint32_t size) {
 		parent_inode_nr = get_parent_dir_inode_nr(child_inode_nr, io_buf);
 		if(get_child_dir_name(parent_inode_nr, child_inode_nr, \
 			full_path_reverse, io_buf) == -1) {
-			sys_free(io_buf);
+			kernel_free(io_buf);
 			return NULL;
 		}
 		child_inode_nr = parent_inode_nr;
@@ -760,7 +790,7 @@ char *sys_getcwd(char *buf, uint32_t size) {
 		// 作为下一次执行strcpy中last_slash的边界
 		*last_slash = 0;
 	}
-	sys_free(io_buf);
+	kernel_free(io_buf);
 	return buf;
 }
 
@@ -818,8 +848,11 @@ void fs_init(void) {
 	uint8_t channel_no = 0;
 	uint8_t dev_no;
 	uint8_t part_index = 0;
+	// 创建文件系统对象的cache
+	inode_cache_init();
+	dir_cache_init();
 	// sp_block用来存储从硬盘上读入的超级块
-	struct super_block *sp_block = (struct super_block*) sys_malloc(SECTOR_SIZE);
+	struct super_block *sp_block = (struct super_block*) kernel_malloc(SECTOR_SIZE);
 	if(sp_block == NULL) {
 		PANIC("alloc memory failed!");
 	}
@@ -840,7 +873,8 @@ void fs_init(void) {
 				// channels数组是全局变量,默认值为0,disk属于其嵌套结构
 				// partition又是disk的嵌套结构,因此partition中的成员默认也是0
 				// 若partition未初始化,则partition中的成员仍为0
-				if(part->sector_count != 0) { // 分区存在
+				// 交换分区由swap_init使用,不能格式化
+				if(part->sector_count != 0 && part->fs_type != PART_TYPE_SWAP) { // 分区存在
 					memset(sp_block, 0, SECTOR_SIZE);
 					// 读取分区超级块的魔数,判断是否存在文件系统
 					// 只支持自己的文件系统,若已存在则不再格式化
@@ -860,7 +894,7 @@ void fs_init(void) {
 		}
 		++channel_no;
 	}
-	sys_free(sp_block);
+	kernel_free(sp_block);
 	// 确定默认操作的分区
 	char default_part[] = "sdb1";
 	// 挂载分区
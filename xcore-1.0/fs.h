@@ -93,7 +93,7 @@ struct directory *sys_opendir(const char *name);
 
 int32_t sys_closedir(struct directory *dir);
 
-struct dir_entry *sys_readdir(struct directory *dir);
+struct dir_entry *sys_readdir(struct directory *dir, struct dir_entry *dir_ent);
 
 void sys_rewinddir(struct directory *dir);
 
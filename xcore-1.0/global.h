@@ -14,9 +14,15 @@
 #define PAGE_P_1 0x1 // present
 #define PAGE_RW_W 0x2 // read/write
 #define PAGE_US_U 0x4 // user
+#define PAGE_A 0x20 // accessed,页被访问过
+#define PAGE_D 0x40 // dirty,页被写入过
+#define PAGE_PS_4M 0x80 // 页目录项直接映射4MB页
+#define PAGE_G 0x100 // 全局页,重新加载cr3时不会从TLB中清除
+#define PAGE_COW 0x200 // 软件使用的位,标记写时复制的只读页
+#define PAGE_SHARED 0x400 // 软件使用的位,标记共享映射的页,fork时不写时复制
+#define PAGE_SWAP 0x800 // 软件使用的位,页表项不存在时表示页已换出,高20位是交换槽号
 #define PAGE_PGD_SIZE 1024 // 页目录大小(单位:4B)
 #define PAGE_PTE_SIZE 1024 // 页表大小(单位:4B)
-#define PAGE_PTE_COUNT 1024 // 内核页表数目(最大是1024,支持4GB物理内存)
 
 // eflags
 #define EFLAGS_MBS (1 << 1) // 此项必须设置
@@ -39,14 +45,15 @@
 // total memory size is placed at 0x90000
 #define TOTAL_MEM_SIZE_PADDR 0x90000
 
-// memory management bitmap physic address
-#define MM_BITMAP_PADDR 0x7c0000
-
 // kernel end physic address(8MB)
 #define KERNEL_END_PADDR 0x800000
 
-// kernel virtual address start
-#define KERNEL_VADDR_START 0xc0800000
+// 临时映射区,内核通过它访问不在直接映射区的页框
+// 最后4MB留给进程页目录的自映射,临时映射区在其之前
+#define KMAP_VADDR 0xff800000
+
+// 内核空间直接映射物理内存的上限
+#define DIRECT_MAP_SIZE (KMAP_VADDR - KERNEL_OFFSET)
 
 // user virtual address start
 #define USER_VADDR_START 0x08048000
@@ -54,6 +61,13 @@
 // user stack3 virtual address
 #define USER_STACK3_VADDR (KERNEL_OFFSET - 0x1000)
 
+// user stack3 max size, pages are allocated on first touch
+#define USER_STACK_SIZE 0x800000
+
+// user heap start, grown by brk/sbrk
+// the first page is reserved for the state of user malloc
+#define USER_HEAP_VADDR 0x40000000
+
 // user program default priority
 #define USER_DEFAULT_PRIORITY 31
 
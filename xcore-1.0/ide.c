@@ -27,6 +27,7 @@
 #define BIT_STAT_BSY 0x80 // 硬盘忙
 #define BIT_STAT_DRDY 0x40 // 驱动器准备好了
 #define BIT_STAT_DRQ 0x8 // 数据传输准备好了
+#define BIT_STAT_ERR 0x1 // 命令执行出错
 
 // device寄存器的一些关键位
 #define BIT_DEV_MBS 0xa0 // 第7位和第5位固定为1
@@ -37,13 +38,45 @@
 #define CMD_IDENTIFY 0xec // identify指令
 #define CMD_READ_SECTOR 0x20 // 读扇区指令
 #define CMD_WRITE_SECTOR 0x30 // 写扇区指令
+#define CMD_READ_DMA 0xc8 // DMA读扇区指令
+#define CMD_WRITE_DMA 0xca // DMA写扇区指令
+
+// bus master IDE寄存器的端口号
+#define reg_bm_cmd(channel) (channel->bmide_base + 0)
+#define reg_bm_status(channel) (channel->bmide_base + 2)
+#define reg_bm_prdt(channel) (channel->bmide_base + 4)
+
+// reg_bm_cmd寄存器的位
+#define BIT_BM_CMD_START 0x1 // 开始传输
+#define BIT_BM_CMD_READ 0x8 // 传输方向为写内存,即读硬盘
+
+// reg_bm_status寄存器的位,中断和错误位写1清除
+#define BIT_BM_STAT_ERR 0x2 // 传输出错
+#define BIT_BM_STAT_INTR 0x4 // 硬盘发出了中断
+#define BIT_BM_STAT_DRV0_DMA 0x20 // 主盘可以DMA,从盘为下一位
+
+// 物理区域描述符表最后一项的标志
+#define PRD_EOT 0x8000
+
+// PCI配置空间的地址端口和数据端口
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_CLASS_IDE 0x0101 // 大类为大容量存储控制器,子类为IDE控制器
+#define PCI_COMMAND_IO 0x1 // 响应IO空间访问
+#define PCI_COMMAND_BUS_MASTER 0x4 // 允许作为bus master访问内存
 
 // 定义可读写的最大扇区数,调试用的
 #define MAX_LBA (10 * 1024 * 1024 / 512 - 1) // 只支持10MB硬盘
 
+// ide_read/ide_write一次提交的bio数
+#define IDE_RW_BIOS 4
+
 // 按硬盘数计算的通道数
 uint8_t channel_count;
 
+// 为true时能DMA的读写都使用DMA,为false时全部使用PIO,用于对比测试
+bool ide_dma_enabled = true;
+
 // 有两个ide通道
 struct ide_channel channels[2];
 
@@ -147,71 +180,314 @@ static bool busy_wait(struct disk *disk) {
 	return false;
 }
 
-// 从硬盘读取sector_count个扇区到buf
-void ide_read(struct disk *disk, uint32_t lba_start, void *buf, uint32_t sector_count) {
-	ASSERT((lba_start <= MAX_LBA) && (sector_count > 0));
-	lock_acquire(&disk->channel->lock);
-	// 1 选择操作的硬盘
-	select_disk(disk);
-	uint32_t secs_op; // 每次操作的扇区数
-	uint32_t secs_done = 0; // 已完成的扇区数
-	while(secs_done < sector_count) {
-		if((secs_done + 256) <= sector_count) {
-			secs_op = 256;
-		} else {
-			secs_op = sector_count - secs_done;
+// 不睡眠地等待硬盘准备好数据传输,可在中断中使用
+static bool drq_wait(struct ide_channel *channel) {
+	uint32_t tries = 1000000;
+	while(tries-- > 0) {
+		uint8_t status = inb(reg_status(channel));
+		if(!(status & BIT_STAT_BSY)) {
+			return (status & BIT_STAT_DRQ);
 		}
-		// 2 写入待读入的扇区数和起始扇区号
-		select_sector(disk, lba_start + secs_done, secs_op);
-		// 3 执行的命令写入reg_cmd寄存器
-		out_cmd(disk->channel, CMD_READ_SECTOR); // 准备开始读数据
-		// 硬盘开始工作后阻塞自己
-		// 等待硬盘完成读操作后通过中断处理程序唤醒自己
-		sema_down(&disk->channel->disk_done);
-		// 4 检测硬盘状态是否可读
-		if(!busy_wait(disk)) { // 失败
-			char error[64];
-			sprintf(error, "%s read sector %d failed!\n", disk->name, lba_start);
-			PANIC(error);
+	}
+	return false;
+}
+
+// buf起始的byte_size字节在DMA时需要的物理区域描述符数
+// buf须在内核的直接映射区且2字节对齐,否则返回0,只能用PIO
+// 直接映射区中虚拟地址连续则物理地址连续,只需在64KB边界处拆分
+static uint32_t dma_prd_count(void *buf, uint32_t byte_size) {
+	uint32_t vaddr = (uint32_t) buf;
+	if(vaddr < KERNEL_OFFSET || vaddr + byte_size > KMAP_VADDR || (vaddr & 1)) {
+		return 0;
+	}
+	uint32_t paddr = kern_v2p(vaddr);
+	return ((paddr + byte_size - 1) >> 16) - (paddr >> 16) + 1;
+}
+
+// 从第index项开始为buf起始的byte_size字节填写物理区域描述符,返回下一项的序号
+static uint32_t dma_fill_prdt(struct ide_channel *channel, uint32_t index, \
+	void *buf, uint32_t byte_size) {
+	uint32_t paddr = kern_v2p((uint32_t) buf);
+	while(byte_size > 0) {
+		ASSERT(index < PRD_ENTRIES);
+		uint32_t len = 0x10000 - (paddr & 0xffff);
+		if(len > byte_size) {
+			len = byte_size;
 		}
-		// 5 把数据从硬盘的缓冲区中读出
-		read_sector(disk, (void*) ((uint32_t) buf + secs_done * 512), secs_op);
-		secs_done += secs_op;
+		channel->prdt[index].paddr = paddr;
+		channel->prdt[index].byte_count = (uint16_t) len;
+		channel->prdt[index].flags = 0;
+		paddr += len;
+		byte_size -= len;
+		++index;
 	}
-	lock_release(&disk->channel->lock);
+	return index;
 }
 
-// 将buf中sector_count个扇区数据写入硬盘
-void ide_write(struct disk *disk, uint32_t lba_start, void *buf, uint32_t sector_count) {
+// 请求在队列中的排序位置,两个硬盘的请求分开,扇区号只有28位
+static uint32_t bio_key(struct bio *bio) {
+	return ((uint32_t) bio->disk->dev_no << 28) | bio->lba_start;
+}
+
+// 以DMA方式开始传输合并链rq,由bus master直接在硬盘和各个bio的buf之间传输
+static void dma_start(struct ide_channel *channel, struct bio *rq) {
+	uint32_t index = 0;
+	for(struct bio *bio = rq; bio != NULL; bio = bio->merge_next) {
+		index = dma_fill_prdt(channel, index, bio->buf, bio->sector_count * 512);
+	}
+	channel->prdt[index - 1].flags = PRD_EOT;
+	outl(reg_bm_prdt(channel), kern_v2p((uint32_t) channel->prdt));
+	outb(reg_bm_cmd(channel), rq->write ? 0 : BIT_BM_CMD_READ);
+	outb(reg_bm_status(channel), inb(reg_bm_status(channel)) | BIT_BM_STAT_INTR | BIT_BM_STAT_ERR);
+	select_sector(rq->disk, rq->lba_start, rq->merge_sectors);
+	out_cmd(channel, rq->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb(reg_bm_cmd(channel), inb(reg_bm_cmd(channel)) | BIT_BM_CMD_START);
+}
+
+// PIO传输下一个扇区,之后把pio_bio和pio_sector移到再下一个扇区,全部传输完时pio_bio为NULL
+static void pio_transfer_sector(struct ide_channel *channel) {
+	struct bio *bio = channel->pio_bio;
+	void *buf = (void*) ((uint32_t) bio->buf + channel->pio_sector * 512);
+	if(bio->write) {
+		write_sector(bio->disk, buf, 1);
+	} else {
+		read_sector(bio->disk, buf, 1);
+	}
+	if(++channel->pio_sector == bio->sector_count) {
+		channel->pio_bio = bio->merge_next;
+		channel->pio_sector = 0;
+	}
+}
+
+// PIO传输失败
+static void pio_error(struct ide_channel *channel) {
+	struct bio *rq = channel->active;
+	char error[64];
+	sprintf(error, "%s %s sector %d failed!\n", rq->disk->name, \
+		rq->write ? "write" : "read", rq->lba_start);
+	PANIC(error);
+}
+
+// 以PIO方式开始传输合并链rq,硬盘每传输完一个扇区发一次中断
+static void pio_start(struct ide_channel *channel, struct bio *rq) {
+	channel->pio_bio = rq;
+	channel->pio_sector = 0;
+	select_sector(rq->disk, rq->lba_start, rq->merge_sectors);
+	out_cmd(channel, rq->write ? CMD_WRITE_SECTOR : CMD_READ_SECTOR);
+	if(rq->write) {
+		// 写入时第一个扇区要主动送出,之后每个中断送出一个
+		if(!drq_wait(channel)) {
+			pio_error(channel);
+		}
+		pio_transfer_sector(channel);
+	}
+}
+
+// 通道空闲时按C-LOOK从队列中取出下一个请求开始传输,调用者须关中断
+// 从上次传输结束的位置向上找第一个请求,上面没有时回到最小的请求
+static void ide_dispatch(struct ide_channel *channel) {
+	ASSERT(get_intr_status() == INTR_OFF);
+	if(channel->active != NULL || list_empty(&channel->bio_queue)) {
+		return;
+	}
+	struct list_ele *ele = channel->bio_queue.head.next;
+	while(ele != &channel->bio_queue.tail \
+		&& bio_key(ELE2ENTRY(struct bio, queue_tag, ele)) < channel->head_pos) {
+		ele = ele->next;
+	}
+	if(ele == &channel->bio_queue.tail) {
+		ele = channel->bio_queue.head.next;
+	}
+	list_remove(ele);
+	struct bio *rq = ELE2ENTRY(struct bio, queue_tag, ele);
+	channel->active = rq;
+	channel->head_pos = bio_key(rq) + rq->merge_sectors;
+	select_disk(rq->disk);
+	channel->active_dma = (ide_dma_enabled && channel->bmide_base != 0 && rq->merge_prds != 0);
+	if(channel->active_dma) {
+		dma_start(channel, rq);
+	} else {
+		pio_start(channel, rq);
+	}
+}
+
+// 合并链rq传输完毕,逐个完成其中的bio后开始下一个请求
+static void ide_request_done(struct ide_channel *channel) {
+	struct bio *bio = channel->active;
+	channel->active = NULL;
+	while(bio != NULL) {
+		// end_io可能释放bio,先取出后继和等待对象
+		struct bio *next = bio->merge_next;
+		struct bio_wait *wait = bio->wait;
+		if(bio->end_io != NULL) {
+			bio->end_io(bio);
+		} else if(--wait->pending == 0) {
+			sema_up(&wait->done);
+		}
+		bio = next;
+	}
+	ide_dispatch(channel);
+}
+
+// 两个请求能否合并为一次传输:同一硬盘,同一方向,总扇区数不超过上限
+// 并且要么都能DMA且描述符表放得下,要么都只能PIO
+static bool bio_mergeable(struct bio *rq, struct bio *bio) {
+	if(rq->disk != bio->disk || rq->write != bio->write \
+		|| rq->merge_sectors + bio->merge_sectors > BIO_MAX_SECTORS) {
+		return false;
+	}
+	if(rq->merge_prds == 0 || bio->merge_prds == 0) {
+		return rq->merge_prds == 0 && bio->merge_prds == 0;
+	}
+	return rq->merge_prds + bio->merge_prds <= PRD_ENTRIES;
+}
+
+// 把请求bio放入通道队列,与扇区相邻的请求合并,否则按扇区号插入
+static void bio_enqueue(struct ide_channel *channel, struct bio *bio) {
+	uint32_t key = bio_key(bio);
+	struct list_ele *ele = channel->bio_queue.head.next;
+	while(ele != &channel->bio_queue.tail) {
+		struct bio *rq = ELE2ENTRY(struct bio, queue_tag, ele);
+		uint32_t rq_key = bio_key(rq);
+		if(rq_key + rq->merge_sectors == key && bio_mergeable(rq, bio)) {
+			// 接在rq之后
+			rq->merge_tail->merge_next = bio;
+			rq->merge_tail = bio;
+			rq->merge_sectors += bio->merge_sectors;
+			rq->merge_prds += bio->merge_prds;
+			return;
+		}
+		if(key + bio->merge_sectors == rq_key && bio_mergeable(rq, bio)) {
+			// 接在rq之前,bio代替rq留在队列中
+			bio->merge_next = rq;
+			bio->merge_tail = rq->merge_tail;
+			bio->merge_sectors += rq->merge_sectors;
+			bio->merge_prds += rq->merge_prds;
+			list_insert_before(ele, &bio->queue_tag);
+			list_remove(ele);
+			return;
+		}
+		if(rq_key > key) {
+			break;
+		}
+		ele = ele->next;
+	}
+	list_insert_before(ele, &bio->queue_tag);
+}
+
+// 初始化等待对象,等待者先持有一个计数,使等待前完成的bio不会唤醒它
+void bio_wait_init(struct bio_wait *wait) {
+	wait->pending = 1;
+	sema_init(&wait->done, 0);
+}
+
+// 提交块IO请求,立即返回,完成时调用bio->end_io或通知bio->wait
+void bio_submit(struct bio *bio) {
+	ASSERT((bio->lba_start <= MAX_LBA) && (bio->sector_count > 0) \
+		&& (bio->sector_count <= BIO_MAX_SECTORS));
+	ASSERT(bio->end_io != NULL || bio->wait != NULL);
+	struct ide_channel *channel = bio->disk->channel;
+	bio->prd_count = dma_prd_count(bio->buf, bio->sector_count * 512);
+	bio->merge_next = NULL;
+	bio->merge_tail = bio;
+	bio->merge_sectors = bio->sector_count;
+	bio->merge_prds = bio->prd_count;
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	if(bio->end_io == NULL) {
+		++bio->wait->pending;
+	}
+	bio_enqueue(channel, bio);
+	ide_dispatch(channel);
+	set_intr_status(old_status);
+}
+
+// 等待提交到wait的所有bio完成,之后wait可以再次使用
+void bio_wait_all(struct bio_wait *wait) {
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	if(--wait->pending != 0) {
+		sema_down(&wait->done);
+	}
+	wait->pending = 1;
+	set_intr_status(old_status);
+}
+
+// 同步读写从lba_start开始的sector_count个扇区,按BIO_MAX_SECTORS拆成多个bio一起等待
+static void ide_rw(struct disk *disk, uint32_t lba_start, void *buf, \
+	uint32_t sector_count, bool write) {
 	ASSERT((lba_start <= MAX_LBA) && (sector_count > 0));
-	lock_acquire(&disk->channel->lock);
-	// 1 选择操作的硬盘
-	select_disk(disk);
-	uint32_t secs_op; // 每次操作的扇区数
-	uint32_t secs_done = 0; // 已完成的扇区数
+	struct bio bios[IDE_RW_BIOS];
+	struct bio_wait wait;
+	bio_wait_init(&wait);
+	uint32_t secs_done = 0; // 已提交的扇区数
 	while(secs_done < sector_count) {
-		if((secs_done + 256) <= sector_count) {
-			secs_op = 256;
-		} else {
-			secs_op = sector_count - secs_done;
+		uint32_t index = 0;
+		while(index < IDE_RW_BIOS && secs_done < sector_count) {
+			struct bio *bio = &bios[index++];
+			bio->disk = disk;
+			bio->lba_start = lba_start + secs_done;
+			bio->sector_count = sector_count - secs_done;
+			if(bio->sector_count > BIO_MAX_SECTORS) {
+				bio->sector_count = BIO_MAX_SECTORS;
+			}
+			bio->buf = (void*) ((uint32_t) buf + secs_done * 512);
+			bio->write = write;
+			bio->end_io = NULL;
+			bio->wait = &wait;
+			bio_submit(bio);
+			secs_done += bio->sector_count;
 		}
-		// 2 写入待写入的扇区数和起始扇区号
-		select_sector(disk, lba_start + secs_done, secs_op);
-		// 3 执行的命令写入reg_cmd寄存器
-		out_cmd(disk->channel, CMD_WRITE_SECTOR); // 准备开始写数据
-		// 4 检测硬盘状态是否可读
-		if(!busy_wait(disk)) { // 失败
+		// bios在栈上,复用前须等它们全部完成
+		bio_wait_all(&wait);
+	}
+}
+
+// 从硬盘读取sector_count个扇区到buf
+void ide_read(struct disk *disk, uint32_t lba_start, void *buf, uint32_t sector_count) {
+	ide_rw(disk, lba_start, buf, sector_count, false);
+}
+
+// 将buf中sector_count个扇区数据写入硬盘
+void ide_write(struct disk *disk, uint32_t lba_start, void *buf, uint32_t sector_count) {
+	ide_rw(disk, lba_start, buf, sector_count, true);
+}
+
+// 正在传输的请求的中断,DMA时整个请求已完成,PIO时完成了一个扇区
+static void ide_request_intr(struct ide_channel *channel) {
+	if(channel->active_dma) {
+		outb(reg_bm_cmd(channel), inb(reg_bm_cmd(channel)) & ~BIT_BM_CMD_START);
+		uint8_t bm_status = inb(reg_bm_status(channel));
+		outb(reg_bm_status(channel), bm_status | BIT_BM_STAT_INTR | BIT_BM_STAT_ERR);
+		// 读取状态寄存器同时应答了硬盘的中断
+		if((bm_status & BIT_BM_STAT_ERR) || (inb(reg_status(channel)) & BIT_STAT_ERR)) {
+			struct bio *rq = channel->active;
 			char error[64];
-			sprintf(error, "%s write sector %d failed!\n", disk->name, lba_start);
+			sprintf(error, "%s dma %s sector %d failed!\n", rq->disk->name, \
+				rq->write ? "write" : "read", rq->lba_start);
 			PANIC(error);
 		}
-		// 5 将数据写入硬盘
-		write_sector(disk, (void*) ((uint32_t) buf + secs_done * 512), secs_op);
-		// 在硬盘响应期间阻塞自己
-		sema_down(&disk->channel->disk_done);
-		secs_done += secs_op;
+		ide_request_done(channel);
+		return;
+	}
+	if(inb(reg_status(channel)) & BIT_STAT_ERR) {
+		pio_error(channel);
 	}
-	lock_release(&disk->channel->lock);
+	if(channel->pio_bio == NULL) {
+		// 写入时最后一个扇区已送出,这是它的完成中断
+		ide_request_done(channel);
+		return;
+	}
+	if(!drq_wait(channel)) {
+		pio_error(channel);
+	}
+	pio_transfer_sector(channel);
+	if(!channel->active->write && channel->pio_bio == NULL) {
+		// 读入时最后一个扇区已取出
+		ide_request_done(channel);
+		return;
+	}
+	channel->expect_intr = true;
 }
 
 // 硬盘中断处理程序
@@ -220,9 +496,13 @@ void intr_disk_handler(uint8_t irq_no) {
 	uint8_t channel_no = irq_no - 0x2e;
 	struct ide_channel *channel = &channels[channel_no];
 	ASSERT(channel->irq_no == irq_no);
-	// 每次读写硬盘时会申请锁,从而保证了同步一致性
+	// 同一时刻通道上只有一个命令,由active或disk_done的等待者发出
 	if(channel->expect_intr) {
 		channel->expect_intr = false;
+		if(channel->active != NULL) {
+			ide_request_intr(channel);
+			return;
+		}
 		sema_up(&channel->disk_done);
 		// 读取状态寄存器使硬盘控制器认为此次中断已被处理
 		// 从而硬盘可以继续执行新的读写
@@ -269,7 +549,7 @@ static void identify_disk(struct disk *disk) {
 
 // 扫描硬盘disk中地址为ext_lba的扇区中的所有分区
 static void partition_scan(struct disk *disk, uint32_t ext_lba) {
-	struct boot_sector *bs = sys_malloc(sizeof(struct boot_sector));
+	struct boot_sector *bs = kernel_malloc(sizeof(struct boot_sector));
 	ide_read(disk, ext_lba, bs, 1);
 	uint8_t part_index = 0;
 	struct partition_table_entry *part_ent = bs->partition_table;
@@ -288,6 +568,7 @@ static void partition_scan(struct disk *disk, uint32_t ext_lba) {
 			if(ext_lba == 0) { // 主分区
 				disk->primary_parts[primary_no].lba_start = ext_lba + part_ent->lba_start;
 				disk->primary_parts[primary_no].sector_count = part_ent->sector_count;
+				disk->primary_parts[primary_no].fs_type = part_ent->fs_type;
 				disk->primary_parts[primary_no].disk = disk;
 				list_append(&partition_list, &disk->primary_parts[primary_no].part_tag);
 				sprintf(disk->primary_parts[primary_no].name, "%s%d", disk->name, primary_no + 1);
@@ -296,6 +577,7 @@ static void partition_scan(struct disk *disk, uint32_t ext_lba) {
 			} else {
 				disk->logic_parts[logic_no].lba_start = ext_lba + part_ent->lba_start;
 				disk->logic_parts[logic_no].sector_count = part_ent->sector_count;
+				disk->logic_parts[logic_no].fs_type = part_ent->fs_type;
 				disk->logic_parts[logic_no].disk = disk;
 				list_append(&partition_list, &disk->logic_parts[logic_no].part_tag);
 				sprintf(disk->logic_parts[logic_no].name, "%s%d", disk->name, logic_no + 5);
@@ -307,7 +589,7 @@ static void partition_scan(struct disk *disk, uint32_t ext_lba) {
 		}
 		++part_ent;
 	}
-	sys_free(bs);
+	kernel_free(bs);
 }
 
 // 打印分区信息
@@ -319,6 +601,43 @@ static bool partition_info(struct list_ele *ele, __attribute__((unused)) int arg
 	return false;
 }
 
+// 读取PCI总线bus上设备dev功能func的配置空间中offset处的双字
+static uint32_t pci_config_read(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+	outl(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (offset & 0xfc));
+	return inl(PCI_CONFIG_DATA);
+}
+
+// 写入PCI总线bus上设备dev功能func的配置空间中offset处的双字
+static void pci_config_write(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset, uint32_t value) {
+	outl(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (offset & 0xfc));
+	outl(PCI_CONFIG_DATA, value);
+}
+
+// 在PCI总线0上查找IDE控制器(如PIIX),允许其作为bus master
+// 返回bus master IDE寄存器的起始端口号(BAR4),没有时返回0
+static uint16_t bmide_probe(void) {
+	for(uint8_t dev = 0; dev < 32; dev++) {
+		for(uint8_t func = 0; func < 8; func++) {
+			if((pci_config_read(0, dev, func, 0x00) & 0xffff) == 0xffff) {
+				continue; // 设备不存在
+			}
+			if((pci_config_read(0, dev, func, 0x08) >> 16) != PCI_CLASS_IDE) {
+				continue;
+			}
+			uint32_t bar4 = pci_config_read(0, dev, func, 0x20);
+			if(!(bar4 & 0x1)) {
+				continue; // bus master寄存器须在IO空间
+			}
+			// 高16位是状态寄存器,写1会清除其中的位,故只写回命令寄存器
+			uint32_t command = pci_config_read(0, dev, func, 0x04) & 0xffff;
+			pci_config_write(0, dev, func, 0x04, \
+				command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+			return bar4 & 0xfffc;
+		}
+	}
+	return 0;
+}
+
 // 硬盘数据结构初始化
 void ide_init(void) {
 	// 获取硬盘数
@@ -327,6 +646,9 @@ void ide_init(void) {
 	list_init(&partition_list);
 	// 一个ide通道有两个硬盘,根据硬盘数量算出ide通道数
 	channel_count = DIV_ROUND_UP(disk_count, 2);
+	// 找不到bus master IDE控制器时所有读写都用PIO
+	uint16_t bmide_base = bmide_probe();
+	printk("bus master ide : %x\n", bmide_base);
 	struct ide_channel *channel;
 	uint8_t channel_no = 0, dev_no = 0;
 	// 处理每个通道上的硬盘
@@ -344,9 +666,14 @@ void ide_init(void) {
 				channel->irq_no = 0x20 + 15;
 				break;
 		}
+		// 第二个通道的bus master寄存器在第一个之后8个端口
+		channel->bmide_base = (bmide_base == 0 ? 0 : bmide_base + channel_no * 8);
 		// 未向硬盘写入指令时不期待硬盘的中断
 		channel->expect_intr = false;
-		lock_init(&channel->lock);
+		// 请求队列为空,C-LOOK从扇区0开始扫描
+		list_init(&channel->bio_queue);
+		channel->active = NULL;
+		channel->head_pos = 0;
 		// 初始化为0,目的是向硬盘控制器请求数据后,
 		// 硬盘驱动sema_down会阻塞线程,
 		// 直到硬盘完成后通过发中断,
@@ -364,6 +691,11 @@ void ide_init(void) {
 			disk->dev_no = dev_no;
 			sprintf(disk->name, "sd%c", 'a' + channel_no * 2 + dev_no);
 			identify_disk(disk); // 获取硬盘参数
+			if(channel->bmide_base != 0) {
+				// 标记此硬盘可以DMA
+				outb(reg_bm_status(channel), \
+					inb(reg_bm_status(channel)) | (BIT_BM_STAT_DRV0_DMA << dev_no));
+			}
 			partition_scan(disk, 0);
 			primary_no = 0;
 			logic_no = 0;
@@ -6,16 +6,21 @@
 #include "bitmap.h"
 #include "sync.h"
 
+#define PART_TYPE_SWAP 0x82 // 交换分区的分区类型
+
 // 分区结构
 struct partition {
 	uint32_t lba_start; // 起始扇区
 	uint32_t sector_count; // 扇区数
+	uint8_t fs_type; // 分区表中的分区类型
 	struct disk *disk; // 分区所属的硬盘
 	struct list_ele part_tag; // 用于队列中的标记
 	char name[8]; // 分区名称
 	struct super_block *sp_block; // 本分区的超级块
 	struct bitmap block_btmp; // 块位图
 	struct bitmap inode_btmp; // inode位图
+	struct bitmap block_btmp_dirty; // 块位图中待写回的扇区
+	struct bitmap inode_btmp_dirty; // inode位图中待写回的扇区
 	struct list open_inodes; // 本分区打开的inode队列
 };
 
@@ -28,17 +33,75 @@ struct disk {
 	struct partition logic_parts[8]; // 逻辑分区支持8个
 };
 
+// DMA的物理区域描述符表的项数,一次最多传输256个扇区(128KB),
+// 合并后的请求由多个缓冲区组成,每项的区域又不能跨越64KB边界
+#define PRD_ENTRIES 16
+
+// 一个bio最多读写的扇区数,也是合并后一次传输的上限
+#define BIO_MAX_SECTORS 256
+
+// 物理区域描述符,描述DMA传输的一段物理内存
+struct prd {
+	uint32_t paddr; // 起始物理地址
+	uint16_t byte_count; // 字节数,0表示64KB
+	uint16_t flags; // 最高位为1表示最后一项
+}__attribute__((packed));
+
+// 一组bio的等待对象,提交多个bio后只需等待一次
+struct bio_wait {
+	uint32_t pending; // 未完成的bio数,另加等待者持有的1
+	struct semaphore done; // 全部完成时唤醒等待者
+};
+
+struct bio;
+
+// bio完成时的回调函数,在硬盘中断中调用
+typedef void (bio_end_io)(struct bio *bio);
+
+// 块IO请求
+struct bio {
+	struct disk *disk; // 读写的硬盘
+	uint32_t lba_start; // 起始扇区
+	uint32_t sector_count; // 扇区数,不超过BIO_MAX_SECTORS
+	void *buf; // 内核缓冲区
+	bool write; // true为写硬盘,false为读硬盘
+	bio_end_io *end_io; // 完成回调,为NULL时通知wait
+	struct bio_wait *wait; // 等待对象
+	void *private; // 留给end_io使用
+	// 以下由驱动维护
+	uint32_t prd_count; // DMA需要的描述符数,0表示只能用PIO
+	struct list_ele queue_tag; // 请求队列中的标记,只有合并链的第一个bio在队列中
+	struct bio *merge_next; // 合并到同一次传输的下一个bio
+	struct bio *merge_tail; // 合并链的最后一个bio,只对第一个bio有效
+	uint32_t merge_sectors; // 合并链的总扇区数,只对第一个bio有效
+	uint32_t merge_prds; // 合并链的总描述符数,只对第一个bio有效
+};
+
 // ata通道结构
 struct ide_channel {
 	char name[8]; // ata通道名称
 	uint16_t port_base; // 起始端口号
 	uint8_t irq_no; // 中断号
-	struct lock lock; // 通道锁
 	bool expect_intr; // 表示等待硬盘的中断
-	struct semaphore disk_done; // 用于阻塞和唤醒驱动程序
+	struct semaphore disk_done; // 用于阻塞和唤醒驱动程序,只用于identify
 	struct disk devices[2]; // 一个通道连接两个硬盘,主和从
+	uint16_t bmide_base; // bus master IDE寄存器的起始端口号,0表示不支持DMA
+	// 物理区域描述符表,需4字节对齐且不能跨越64KB边界,按表的大小对齐即可保证
+	struct prd prdt[PRD_ENTRIES] __attribute__((aligned(sizeof(struct prd) * PRD_ENTRIES)));
+	struct list bio_queue; // 等待传输的请求,按(硬盘号,扇区号)升序排列
+	struct bio *active; // 正在传输的合并链,NULL表示通道空闲
+	bool active_dma; // 正在传输的请求是否使用DMA
+	struct bio *pio_bio; // PIO下一个要传输的扇区所在的bio
+	uint32_t pio_sector; // PIO下一个要传输的扇区在pio_bio中的序号
+	uint32_t head_pos; // 上次传输结束的位置,C-LOOK从这里继续向上扫描
 };
 
+void bio_wait_init(struct bio_wait *wait);
+
+void bio_submit(struct bio *bio);
+
+void bio_wait_all(struct bio_wait *wait);
+
 void ide_read(struct disk *disk, uint32_t lba_start, void *buf, uint32_t sector_count);
 
 void ide_write(struct disk *disk, uint32_t lba_start, void *buf, uint32_t sector_count);
@@ -7,12 +7,16 @@
 #include "keyboard.h"
 #include "syscall.h"
 #include "ide.h"
+#include "bcache.h"
 #include "fs.h"
+#include "string.h"
+#include "swap.h"
 
 void init_all() {
 	init_gdt(); // 初始化GDT
 	init_idt(); // 初始化IDT
 	init_timer(); // 初始化定时器
+	string_init(); // 根据CPU特性选择mem函数的实现
 	mm_init(); // 初始化内存管理
 	thread_init(); // 初始化线程
 	console_init(); //初始化终端
@@ -20,5 +24,7 @@ void init_all() {
 	syscall_init(); // 初始化系统调用
 	enable_intr(); // 开中断
 	ide_init(); // 初始化硬盘
+	bcache_init(); // 初始化缓冲区缓存
 	fs_init(); // 初始化文件系统
+	swap_init(); // 初始化交换分区
 }
\ No newline at end of file
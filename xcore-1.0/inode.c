@@ -1,6 +1,7 @@
 #include "types.h"
 #include "string.h"
 #include "ide.h"
+#include "bcache.h"
 #include "debug.h"
 #include "inode.h"
 #include "list.h"
@@ -10,10 +11,14 @@
 #include "interrupt.h"
 #include "fs.h"
 #include "file.h"
+#include "slab.h"
 
 // 默认情况下操作的分区
 extern struct partition *cur_part;
 
+// 内存中inode的cache
+struct kmem_cache *inode_cache;
+
 // inode位置结构体
 struct inode_position {
 	bool cross_sector; // inode是否跨扇区
@@ -67,13 +72,13 @@ void inode_sync(struct partition *part, struct inode *inode, void *io_buf) {
 		// 跨扇区,需要读出两个扇区再写入两个扇区
 		// 读写硬盘是以扇区为单位,若写入的数据小于1扇区,
 		// 要将原硬盘上的内容先读出来再和新数据拼成1扇区后再写入
-		ide_read(part->disk, inode_pos.sector_lba, inode_buf, 2);
+		bcache_read(part->disk, inode_pos.sector_lba, inode_buf, 2);
 		memcpy(inode_buf + inode_pos.sector_offset, &pure_inode, sizeof(struct inode));
-		ide_write(part->disk, inode_pos.sector_lba, inode_buf, 2);
+		bcache_write(part->disk, inode_pos.sector_lba, inode_buf, 2);
 	} else { // 不跨扇区
-		ide_read(part->disk, inode_pos.sector_lba, inode_buf, 1);
+		bcache_read(part->disk, inode_pos.sector_lba, inode_buf, 1);
 		memcpy(inode_buf + inode_pos.sector_offset, &pure_inode, sizeof(struct inode));
-		ide_write(part->disk, inode_pos.sector_lba, inode_buf, 1);
+		bcache_write(part->disk, inode_pos.sector_lba, inode_buf, 1);
 	}
 }
 
@@ -94,28 +99,23 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no) {
 	// 下面从硬盘上读入此inode并加入到此链表
 	struct inode_position inode_pos;
 	inode_locate(part, inode_no, &inode_pos);
-	// 为使通过sys_malloc创建的新inode被所有任务共享,
-	// 需要将inode置于内核空间,故需要临时将cur_thread->pgdir置为NULL
-	struct task_struct *cur_thread = current_thread();
-	uint32_t *pgdir_bak = cur_thread->pgdir;
-	cur_thread->pgdir = NULL;
-	// 以上三行代码完成后,下面分配的内存将位于内核区
-	inode_found = (struct inode*) sys_malloc(sizeof(struct inode));
-	cur_thread->pgdir = pgdir_bak; // 恢复pgdir
+	// inode从内核的inode_cache分配,被所有任务共享
+	inode_found = (struct inode*) kmem_cache_alloc(inode_cache);
+	ASSERT(inode_found != NULL);
 	char *inode_buf;
 	if(inode_pos.cross_sector) { // 跨扇区
-		inode_buf = (char*) sys_malloc(1024);
+		inode_buf = (char*) kernel_malloc(1024);
 		// inode表是被partition_format函数连续写入扇区的
-		ide_read(part->disk, inode_pos.sector_lba, inode_buf, 2);
+		bcache_read(part->disk, inode_pos.sector_lba, inode_buf, 2);
 	} else { // 未跨扇区
-		inode_buf = (char*) sys_malloc(512);
-		ide_read(part->disk, inode_pos.sector_lba, inode_buf, 1);
+		inode_buf = (char*) kernel_malloc(512);
+		bcache_read(part->disk, inode_pos.sector_lba, inode_buf, 1);
 	}
 	memcpy(inode_found, inode_buf + inode_pos.sector_offset, sizeof(struct inode));
 	// 因为要用到此inode,故将其插入到队首便于提前检索到
 	list_push(&part->open_inodes, &inode_found->inode_tag);
 	inode_found->open_count = 1;
-	sys_free(inode_buf);
+	kernel_free(inode_buf);
 	return inode_found;
 }
 
@@ -127,12 +127,7 @@ void inode_close(struct inode *inode) {
 	if(--inode->open_count == 0) {
 		// 将inode从part->open_inodes中去掉
 		list_remove(&inode->inode_tag);
-		// 释放inode时要保证释放的是内核内存池
-		struct task_struct *cur_thread = current_thread();
-		uint32_t *pgdir_bak = cur_thread->pgdir;
-		cur_thread->pgdir = NULL;
-		sys_free(inode);
-		cur_thread->pgdir = pgdir_bak; // 恢复pgdir
+		kmem_cache_free(inode_cache, inode);
 	}
 	set_intr_status(old_status);
 }
@@ -146,18 +141,18 @@ void inode_delete(struct partition *part, uint32_t inode_no, void *io_buf) {
 	char *inode_buf = (char*) io_buf;
 	if(inode_pos.cross_sector) { // 跨扇区
 		// 将原硬盘上的内容先读出来
-		ide_read(part->disk, inode_pos.sector_lba, inode_buf, 2);
+		bcache_read(part->disk, inode_pos.sector_lba, inode_buf, 2);
 		// 将inode_buf清0
 		memset(inode_buf + inode_pos.sector_offset, 0, sizeof(struct inode));
 		// 用清0的内存数据覆盖磁盘
-		ide_write(part->disk, inode_pos.sector_lba, inode_buf, 2);
+		bcache_write(part->disk, inode_pos.sector_lba, inode_buf, 2);
 	} else { // 不跨扇区
 		// 将原硬盘上的内容先读出来
-		ide_read(part->disk, inode_pos.sector_lba, inode_buf, 1);
+		bcache_read(part->disk, inode_pos.sector_lba, inode_buf, 1);
 		// 将inode_buf清0
 		memset(inode_buf + inode_pos.sector_offset, 0, sizeof(struct inode));
 		// 用清0的内存数据覆盖磁盘
-		ide_write(part->disk, inode_pos.sector_lba, inode_buf, 1);
+		bcache_write(part->disk, inode_pos.sector_lba, inode_buf, 1);
 	}
 }
 
@@ -178,7 +173,7 @@ void inode_release(struct partition *part, uint32_t inode_no) {
 	// b 如果一级间接块表存在,将其128个间接块读到all_blocks[12-],
 	// 然后释放一级间接块表所占的扇区
 	if(inode_del->sectors[12] != 0) {
-		ide_read(part->disk, inode_del->sectors[12], all_blocks + 12, 1);
+		bcache_read(part->disk, inode_del->sectors[12], all_blocks + 12, 1);
 		block_count = 140;
 		// 回收一级间接块表占用的扇区
 		block_btmp_index = inode_del->sectors[12] - part->sp_block->data_lba_start;
@@ -206,9 +201,15 @@ void inode_release(struct partition *part, uint32_t inode_no) {
 	// 此函数会在inode_table中将此inode清0
 	// 但实际上是不需要的,inode分配是由inode位图控制的
 	// 硬盘上的数据不需要清0,可以直接覆盖
-	void *io_buf = sys_malloc(1024);
+	void *io_buf = kernel_malloc(1024);
 	inode_delete(part, inode_no, io_buf);
-	sys_free(io_buf);
+	kernel_free(io_buf);
+	
+	// 先让删除了目录项的目录块和清空的inode落盘,再写回位图,
+	// 否则崩溃后硬盘上仍被引用的块可能已被标记为空闲而重复分配
+	// 位图的修改也包括delete_dir_entry释放的目录块
+	bcache_flush();
+	bitmap_flush(cur_part, false);
 	
 	inode_close(inode_del);
 }
@@ -225,6 +226,12 @@ void inode_init(uint32_t inode_no, struct inode *inode) {
 	}
 }
 
+// 创建inode_cache
+void inode_cache_init(void) {
+	inode_cache = kmem_cache_create("inode", sizeof(struct inode), 0, NULL);
+	ASSERT(inode_cache != NULL);
+}
+
 
 
 
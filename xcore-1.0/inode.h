@@ -26,4 +26,6 @@ void inode_release(struct partition *part, uint32_t inode_no);
 
 void inode_init(uint32_t inode_no, struct inode *inode);
 
+void inode_cache_init(void);
+
 #endif
\ No newline at end of file
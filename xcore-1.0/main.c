@@ -14,6 +14,11 @@
 #include "fs.h"
 #include "shell.h"
 #include "file.h"
+#include "x86.h"
+#include "debug.h"
+#include "umalloc.h"
+#include "timer.h"
+#include "ide.h"
 
 #define CHECK_FLAG(flag, bit) ((flag) & (1 << (bit)))
 
@@ -68,6 +73,11 @@ void k_thread_a(void *);
 void k_thread_b(void *);
 void u_prog_a(void);
 void u_prog_b(void);
+void pgdir_bench(void);
+void string_bench(void);
+void u_fork_exit_bench(void);
+void free_pages_monitor(void *);
+void ide_bench(void);
 
 int a_pid = 0, b_pid = 0;
 
@@ -84,6 +94,8 @@ void kmain(struct multiboot *mboot_ptr) {
 	
 	//process_execute(u_prog_a, "u_prog_a");
 	//process_execute(u_prog_b, "u_prog_b");
+	//process_execute(u_fork_exit_bench, "fork_exit");
+	//thread_start("free_monitor", 31, free_pages_monitor, NULL);
 	
 	//enable_intr();
 	
@@ -92,6 +104,10 @@ void kmain(struct multiboot *mboot_ptr) {
 	//thread_start("k_thread_a", 31, k_thread_a, "A_");
 	//thread_start("k_thread_b", 8, k_thread_b, "B_");
 	
+	//pgdir_bench();
+	//string_bench();
+	//ide_bench();
+	
 	//struct file_stat stat;
 	//sys_stat("/", &stat);
 	//printk("i_no : %d, size %d, f_type : %s\n", stat.i_no, stat.size, stat.f_type == 2 ? "directory" : "file");
@@ -115,7 +131,11 @@ void get_total_mem(struct multiboot *mboot_ptr) {
 void init(void) {
 	uint32_t ret_pid = fork();
 	if(ret_pid) { // 父进程
-		while(1);
+		// 回收退出的子进程,包括过继给init的孤儿进程
+		int32_t status;
+		while(1) {
+			wait(&status);
+		}
 	} else { // 子进程
 		simple_shell();
 	}
@@ -229,6 +249,197 @@ void u_prog_b(void) {
 	while(1);
 }
 
+// 页目录切换基准测试使用的参数
+#define BENCH_ROUNDS 10000 // 切换轮数
+#define BENCH_TOUCH_PAGES 64 // 每次切换后访问的内核页数,计入TLB重新填充的开销
+
+extern bool pgdir_reload_always;
+extern uint32_t cr3_load_count;
+
+// 在任务a和b之间反复切换页目录,返回每次切换的平均周期数
+static uint32_t pgdir_bench_run(struct task_struct *a, struct task_struct *b, \
+	volatile uint32_t *buf) {
+	uint32_t sum = 0;
+	uint64_t start = rdtsc();
+	for(uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+		pgdir_activate(i % 2 ? b : a);
+		for(uint32_t j = 0; j < BENCH_TOUCH_PAGES; j++) {
+			sum += buf[j * PAGE_SIZE / 4];
+		}
+	}
+	uint32_t cycles = (uint32_t) (rdtsc() - start);
+	buf[0] = sum;
+	return cycles / BENCH_ROUNDS;
+}
+
+// 比较每次都加载cr3与按需加载cr3(lazy TLB)时页目录切换的开销
+void pgdir_bench(void) {
+	struct task_struct *kthread = current_thread();
+	ASSERT(kthread->pgdir == NULL);
+	// 模拟的用户进程,只用到pgdir字段
+	struct task_struct *uproc = get_kernel_pages(1);
+	uproc->pgdir = create_pgdir();
+	uint32_t *buf = get_kernel_pages(BENCH_TOUCH_PAGES);
+	ASSERT(uproc->pgdir != NULL && buf != NULL);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	for(uint32_t mode = 0; mode < 2; mode++) {
+		pgdir_reload_always = (mode == 0);
+		uint32_t loads = cr3_load_count;
+		uint32_t kk = pgdir_bench_run(kthread, kthread, buf);
+		uint32_t pk = pgdir_bench_run(uproc, kthread, buf);
+		printk("%s : thread<->thread %d cycles, process<->thread %d cycles, cr3 loads %d\n", \
+			mode == 0 ? "reload always" : "lazy", kk, pk, cr3_load_count - loads);
+	}
+	// 切回内核页目录后再释放模拟进程的页目录
+	pgdir_reload_always = true;
+	pgdir_activate(kthread);
+	pgdir_reload_always = false;
+	set_intr_status(old_status);
+	kfree(buf, BENCH_TOUCH_PAGES);
+	kfree(uproc->pgdir, 1);
+	kfree(uproc, 1);
+}
+
+// mem函数基准测试使用的参数
+#define STRING_BENCH_ROUNDS 64 // 每种大小的调用次数
+#define STRING_BENCH_MAX 65536 // 最大测试大小
+
+extern bool string_sse2_enabled;
+
+// 逐字节复制,作为对比的基准
+static void memcpy_bytewise(void *dst, const void *src, uint32_t size) {
+	uint8_t *_dst = (uint8_t*) dst;
+	const uint8_t *_src = (const uint8_t*) src;
+	while(size-- > 0) {
+		*_dst++ = *_src++;
+	}
+}
+
+// 打印每周期处理的字节数,保留两位小数
+static void string_bench_print(const char *name, uint32_t size, uint64_t cycles) {
+	uint32_t per_call = (uint32_t) cycles / STRING_BENCH_ROUNDS;
+	if(per_call == 0) {
+		per_call = 1;
+	}
+	uint32_t rate = size * 100 / per_call;
+	printk("  %s %d bytes : %d.%d%d bytes/cycle\n", name, size, \
+		rate / 100, rate / 10 % 10, rate % 10);
+}
+
+// 测试各大小下memset,memcpy的吞吐量,比较逐字节,rep指令和SSE2三种实现
+void string_bench(void) {
+	uint32_t page_count = STRING_BENCH_MAX / PAGE_SIZE;
+	uint8_t *src = get_kernel_pages(page_count);
+	uint8_t *dst = get_kernel_pages(page_count);
+	ASSERT(src != NULL && dst != NULL);
+	bool sse2 = string_sse2_enabled;
+	for(uint32_t mode = 0; mode < 3; mode++) {
+		if(mode == 2 && !sse2) {
+			break;
+		}
+		string_sse2_enabled = (mode == 2);
+		printk("%s :\n", mode == 0 ? "bytewise" : (mode == 1 ? "rep" : "sse2"));
+		for(uint32_t size = 16; size <= STRING_BENCH_MAX; size *= 4) {
+			uint64_t start = rdtsc();
+			for(uint32_t i = 0; i < STRING_BENCH_ROUNDS; i++) {
+				if(mode == 0) {
+					memcpy_bytewise(dst, src, size);
+				} else {
+					memcpy(dst, src, size);
+				}
+			}
+			string_bench_print("memcpy", size, rdtsc() - start);
+			if(mode == 0) {
+				continue;
+			}
+			start = rdtsc();
+			for(uint32_t i = 0; i < STRING_BENCH_ROUNDS; i++) {
+				memset(dst, (uint8_t) i, size);
+			}
+			string_bench_print("memset", size, rdtsc() - start);
+		}
+	}
+	string_sse2_enabled = sse2;
+	kfree(src, page_count);
+	kfree(dst, page_count);
+}
+
+// fork/exit压力测试使用的参数
+#define FORK_EXIT_ROUNDS 5000 // fork并退出的子进程数
+#define FORK_EXIT_REPORT 1000 // 每隔多少个子进程报告一次
+
+// 用户进程,反复fork立即退出的子进程并wait回收
+// 与free_pages_monitor一起运行,空闲页数应保持平稳
+void u_fork_exit_bench(void) {
+	for(uint32_t i = 1; i <= FORK_EXIT_ROUNDS; i++) {
+		int32_t pid = fork();
+		if(pid == 0) {
+			// 子进程先访问栈和堆,使exit需要归还页框和页表
+			char *buf = malloc(64);
+			buf[0] = (char) i;
+			exit(i);
+		}
+		int32_t status;
+		if(wait(&status) != pid || status != (int32_t) i) {
+			printf("fork_exit : wait failed at %d\n", i);
+			break;
+		}
+		if(i % FORK_EXIT_REPORT == 0) {
+			printf("fork_exit : %d children reaped\n", i);
+		}
+	}
+	exit(0);
+}
+
+// 内核线程,每秒打印一次空闲页框数
+void free_pages_monitor(__attribute__((unused)) void *arg) {
+	while(1) {
+		printk("free pages : kernel %d, user %d\n", \
+			free_page_count(PF_KERNEL), free_page_count(PF_USER));
+		sleep(1000);
+	}
+}
+
+#define IDE_BENCH_SECTORS 4096 // 顺序读取的扇区数(2MB)
+#define IDE_BENCH_CHUNK 128 // 每次读取的扇区数(64KB)
+
+extern struct ide_channel channels[2];
+extern bool ide_dma_enabled;
+extern struct task_struct *idle_thread;
+extern uint32_t ticks;
+
+// 分别用PIO和DMA顺序读取sdb,比较吞吐量和CPU占用率
+// CPU占用率由idle线程在此期间运行的嘀嗒数推算
+void ide_bench(void) {
+	struct disk *disk = &channels[0].devices[1];
+	void *buf = get_kernel_pages(IDE_BENCH_CHUNK * 512 / PAGE_SIZE);
+	ASSERT(buf != NULL);
+	bool enabled = ide_dma_enabled;
+	// 硬盘读写由中断完成,测试期间须开中断
+	enum intr_status old_status = get_intr_status();
+	enable_intr();
+	for(uint32_t mode = 0; mode < 2; mode++) {
+		ide_dma_enabled = (mode == 1);
+		uint32_t start_ticks = ticks;
+		uint32_t idle_ticks = idle_thread->elapsed_ticks;
+		uint64_t start = rdtsc();
+		for(uint32_t lba = 0; lba < IDE_BENCH_SECTORS; lba += IDE_BENCH_CHUNK) {
+			ide_read(disk, lba, buf, IDE_BENCH_CHUNK);
+		}
+		// 以1024个周期为单位,避免32位溢出
+		uint32_t kcycles = (uint32_t) ((rdtsc() - start) >> 10);
+		uint32_t elapsed = ticks - start_ticks;
+		uint32_t idle = idle_thread->elapsed_ticks - idle_ticks;
+		printk("%s : %dKB in %d ticks, %d kcycles, cpu busy %d percent\n", \
+			mode == 0 ? "pio" : "dma", IDE_BENCH_SECTORS / 2, elapsed, kcycles, \
+			elapsed == 0 ? 100 : (elapsed - idle) * 100 / elapsed);
+	}
+	set_intr_status(old_status);
+	ide_dma_enabled = enabled;
+	kfree(buf, IDE_BENCH_CHUNK * 512 / PAGE_SIZE);
+}
+
 
 
 
@@ -8,6 +8,27 @@
 #include "thread.h"
 #include "string.h"
 #include "interrupt.h"
+#include "slab.h"
+#include "x86.h"
+#include "vma.h"
+#include "multiboot.h"
+#include "mmap.h"
+#include "swap.h"
+#include "shm.h"
+
+// 开启MM_DEBUG(编译时加-DMM_DEBUG)后,释放内存块时检查重复释放等错误
+
+// 页错误码
+#define PF_ERR_P 0x1 // 0表示页不存在,1表示违反页级保护
+#define PF_ERR_W 0x2 // 1表示写操作引发
+#define PF_ERR_U 0x4 // 1表示在用户态引发
+
+#define MAX_MEM_RANGES 16 // 最多记录的可用物理内存区间数
+
+// 用户页从内核内存池借用时,为内核保留的空闲页比例(1/KERNEL_RESERVE_RATIO)
+#define KERNEL_RESERVE_RATIO 16
+
+#define ZEROED_PAGES_MAX 64 // 每个内存池最多保留的预清零页框数
 
 // 内存仓库
 struct arena {
@@ -16,296 +37,961 @@ struct arena {
 	// 否则表示空闲mem_block数量
 	uint32_t count;
 	bool large;
+	uint32_t carved; // 已从arena中切出过的内存块数
+	struct mem_block *free_blocks; // arena内释放过的空闲内存块链表
+	struct list_ele partial_tag; // 在mem_block_desc的partial_list中的节点
+};
+
+// 可用物理内存区间[start, end)
+struct mem_range {
+	uint32_t start;
+	uint32_t end;
 };
 
 // 物理内存池
 struct memory_pool {
-	struct bitmap pool_btmp;
+	struct page *pages; // 本内存池在mem_map中的第一个页框描述符
+	struct list free_area[MAX_ORDER]; // buddy各阶空闲块链表
 	uint32_t paddr_start;
 	uint32_t pool_size; // 字节大小
+	uint32_t page_count; // 页框总数
+	uint32_t free_pages; // 空闲页框数
+	struct list zeroed; // 已清0的页框,由idle线程补充,不计入free_pages
+	uint32_t zeroed_count; // zeroed中的页框数
+	uint32_t zeroed_pending; // idle线程已清0但因锁被占用还未放入zeroed的页框,0表示没有
 	struct lock lock;
 };
 
 // 内核页目录数组
 uint32_t pgd_kern[PAGE_PGD_SIZE] __attribute__((aligned(PAGE_SIZE)));
 
-// 内核页表数组
-static uint32_t pte_kern[PAGE_PTE_COUNT][PAGE_PTE_SIZE] __attribute__((aligned(PAGE_SIZE)));
-
-// 内核物理内存池
+// 内核物理内存池,由直接映射区内的内存组成
 static struct memory_pool kernel_pool;
-// 用户物理内存池
+// 用户物理内存池,由直接映射区之外的内存组成,内存不多时为空,
+// 用户页此时从内核内存池借用
 static struct memory_pool user_pool;
 
-// 内核虚拟地址池
-static struct vaddr_pool kernel_vaddr_pool;
+// 从multiboot内存映射中得到的可用物理内存区间,按地址升序
+static struct mem_range mem_ranges[MAX_MEM_RANGES];
+static uint32_t mem_range_count;
+
+// 所有物理页框的描述符,下标是页框号,覆盖0到最高可用地址
+static struct page *mem_map;
+static uint32_t max_pfn;
+
+// 直接映射到内核空间的物理内存大小,物理地址paddr对应虚拟地址P2V(paddr)
+static uint32_t direct_map_size;
+
+// 临时映射区的页表
+static uint32_t *kmap_pte;
 
 // 内核内存块描述符数组
 struct mem_block_desc kernel_block_descs[MEM_BLOCK_DESC_COUNT];
 
-// 初始化内核虚拟地址
-static void init_kernel_vmm() {
-	uint32_t kern_pte_base = GET_PGD_INDEX(KERNEL_OFFSET);
-	uint32_t kern_pte_count = PAGE_PTE_COUNT / 2;
-	// 内核页目录表最多 1023 - 768 + 1 = 256
-	// 768~1023 --> 0~255
-	if(kern_pte_count > 256) {
-		kern_pte_count = 256;
+// 内核堆的锁,保护kernel_block_descs
+static struct lock kernel_heap_lock;
+
+// 需要清0的页时,预清零页框的命中和未命中次数
+uint32_t zeroed_page_hits;
+uint32_t zeroed_page_misses;
+
+// 为true时单页框和内核内存块的分配释放先经过当前任务的magazine
+// 主线程的PCB建立之前current_thread()不可用,由thread_init开启
+bool magazines_enabled;
+
+// 内核映像结束地址,定义在link.ld
+extern uint8_t kern_end[];
+
+// multiboot信息结构体,定义在boot.S
+extern struct multiboot *glb_mboot_ptr;
+
+// 启动阶段分配内存管理元数据的位置,紧跟在内核映像之后
+static uint32_t boot_alloc_ptr;
+
+// boot_alloc可用的物理地址上限,直接映射建立之前只有0-8MB已映射
+static uint32_t boot_alloc_limit = KERNEL_END_PADDR;
+
+// 启动阶段分配size字节并清0,只能在mm_init中使用
+static void *boot_alloc(uint32_t size) {
+	void *ptr = (void*) boot_alloc_ptr;
+	boot_alloc_ptr += (size + 3) & ~3;
+	ASSERT(V2P(boot_alloc_ptr) <= boot_alloc_limit);
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+// 启动阶段分配一个按页对齐的页
+static void *boot_alloc_page(void) {
+	boot_alloc_ptr = (boot_alloc_ptr + PAGE_SIZE - 1) & 0xfffff000;
+	return boot_alloc(PAGE_SIZE);
+}
+
+// 建立内核空间对物理内存的直接映射
+// CPU支持PSE时用4MB页映射,不需要页表,否则才为每4MB分配一个页表
+// CPU支持PGE时内核映射标记为全局页,切换进程页目录时不会被清出TLB
+// 临时映射区的页表也在此建立,所有进程页目录都会复制到它
+static void init_kernel_vmm(uint32_t mem_size) {
+	uint32_t map_size = mem_size < DIRECT_MAP_SIZE ? mem_size : DIRECT_MAP_SIZE;
+	uint32_t pde_count = DIV_ROUND_UP(map_size, PAGE_SIZE * PAGE_PTE_SIZE);
+	// 至少映射0-8MB的内核映像区
+	if(pde_count < KERNEL_END_PADDR / (PAGE_SIZE * PAGE_PTE_SIZE)) {
+		pde_count = KERNEL_END_PADDR / (PAGE_SIZE * PAGE_PTE_SIZE);
+	}
+	direct_map_size = pde_count * PAGE_SIZE * PAGE_PTE_SIZE;
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	bool pse = edx & CPUID_EDX_PSE;
+	bool pge = edx & CPUID_EDX_PGE;
+	if(pse) {
+		write_cr4(read_cr4() | CR4_PSE);
+	}
+	uint32_t pgd_base = GET_PGD_INDEX(KERNEL_OFFSET);
+	for(uint32_t i = 0; i < pde_count; i++) {
+		uint32_t paddr = i * PAGE_SIZE * PAGE_PTE_SIZE;
+		// 用户程序在内核映像中运行,故0-8MB需要用户可访问
+		uint32_t flags = PAGE_P_1 | PAGE_RW_W;
+		if(paddr < KERNEL_END_PADDR) {
+			flags |= PAGE_US_U;
+		}
+		uint32_t global = pge ? PAGE_G : 0;
+		if(pse) {
+			pgd_kern[pgd_base + i] = paddr | PAGE_PS_4M | global | flags;
+		} else {
+			uint32_t *pte = boot_alloc_page();
+			for(uint32_t j = 0; j < PAGE_PTE_SIZE; j++) {
+				pte[j] = (paddr + j * PAGE_SIZE) | global | flags;
+			}
+			pgd_kern[pgd_base + i] = V2P((uint32_t) pte) | flags;
+		}
+	}
+	kmap_pte = boot_alloc_page();
+	pgd_kern[GET_PGD_INDEX(KMAP_VADDR)] = V2P((uint32_t) kmap_pte) | PAGE_P_1 | PAGE_RW_W;
+	__asm__ __volatile__("mov %0, %%cr3" : : "r"(V2P((uint32_t) pgd_kern)) : "memory");
+	// 内核写只读的用户页时也要产生页错误,写时复制才能生效
+	write_cr0(read_cr0() | CR0_WP);
+	// 分页开启后再打开PGE
+	if(pge) {
+		write_cr4(read_cr4() | CR4_PGE);
+	}
+	printk("direct map %dMB with %s pages%s\n", direct_map_size / 0x100000, \
+		pse ? "4MB" : "4KB", pge ? ", global" : "");
+}
+
+// 将pool中以page_index起始的2^order个页框作为空闲块挂到对应链表
+static void buddy_add_block(struct memory_pool *pool, uint32_t page_index, uint32_t order) {
+	struct page *page = &pool->pages[page_index];
+	page->order = order;
+	page->flags |= PG_FREE;
+	list_push(&pool->free_area[order], &page->free_ele);
+}
+
+// 从pool中分配2^order个连续页框,成功返回首页框的索引,失败返回-1
+static int32_t buddy_alloc(struct memory_pool *pool, uint32_t order) {
+	ASSERT(order < MAX_ORDER);
+	// 找到不小于order的最小非空链表
+	uint32_t cur_order = order;
+	while(cur_order < MAX_ORDER && list_empty(&pool->free_area[cur_order])) {
+		++cur_order;
+	}
+	if(cur_order == MAX_ORDER) {
+		return -1;
+	}
+	struct page *page = ELE2ENTRY(struct page, free_ele, \
+		list_pop(&pool->free_area[cur_order]));
+	page->flags &= ~PG_FREE;
+	uint32_t page_index = page - pool->pages;
+	// 大块逐级对半拆分,后一半挂回低一阶的链表
+	while(cur_order > order) {
+		--cur_order;
+		buddy_add_block(pool, page_index + (1 << cur_order), cur_order);
+	}
+	page->order = order;
+	pool->free_pages -= (1 << order);
+	return page_index;
+}
+
+// 将pool中以page_index起始的2^order个页框归还,并与空闲的伙伴块合并
+static void buddy_free(struct memory_pool *pool, uint32_t page_index, uint32_t order) {
+	ASSERT(page_index < pool->page_count && order < MAX_ORDER);
+	ASSERT(!(pool->pages[page_index].flags & (PG_FREE | PG_RESERVED)));
+	pool->free_pages += (1 << order);
+	while(order < MAX_ORDER - 1) {
+		uint32_t buddy_index = page_index ^ (1 << order);
+		if(buddy_index + (1 << order) > pool->page_count) {
+			break;
+		}
+		struct page *buddy = &pool->pages[buddy_index];
+		// 伙伴块必须空闲且阶相同才能合并
+		if(!(buddy->flags & PG_FREE) || buddy->order != order) {
+			break;
+		}
+		list_remove(&buddy->free_ele);
+		buddy->flags &= ~PG_FREE;
+		page_index &= ~(1 << order);
+		++order;
+	}
+	buddy_add_block(pool, page_index, order);
+}
+
+// 将pool中以page_index起始的count个页框按对齐的最大块归还,调用者持有pool->lock
+static void buddy_free_range(struct memory_pool *pool, uint32_t page_index, uint32_t count) {
+	uint32_t end = page_index + count;
+	while(page_index < end) {
+		uint32_t order = 0;
+		while(order < MAX_ORDER - 1 && !(page_index & (1 << order)) \
+			&& (page_index + (2 << order) <= end)) {
+			++order;
+		}
+		buddy_free(pool, page_index, order);
+		page_index += (1 << order);
+	}
+}
+
+// 初始化物理内存池,管理物理地址[paddr_start, paddr_end)
+// 其中只有mem_ranges内的页框放入空闲链表,内存空洞保持PG_RESERVED
+static void init_pool(struct memory_pool *pool, uint32_t paddr_start, uint32_t paddr_end) {
+	pool->paddr_start = paddr_start;
+	pool->page_count = (paddr_end - paddr_start) / PAGE_SIZE;
+	pool->pool_size = pool->page_count * PAGE_SIZE;
+	pool->free_pages = 0;
+	pool->pages = &mem_map[paddr_start / PAGE_SIZE];
+	for(uint32_t i = 0; i < MAX_ORDER; i++) {
+		list_init(&pool->free_area[i]);
+	}
+	list_init(&pool->zeroed);
+	pool->zeroed_count = 0;
+	pool->zeroed_pending = 0;
+	for(uint32_t i = 0; i < mem_range_count; i++) {
+		uint32_t start = mem_ranges[i].start > paddr_start ? mem_ranges[i].start : paddr_start;
+		uint32_t end = mem_ranges[i].end < paddr_end ? mem_ranges[i].end : paddr_end;
+		if(start >= end) {
+			continue;
+		}
+		uint32_t page_index = (start - paddr_start) / PAGE_SIZE;
+		uint32_t count = (end - start) / PAGE_SIZE;
+		for(uint32_t j = 0; j < count; j++) {
+			pool->pages[page_index + j].flags &= ~PG_RESERVED;
+		}
+		// 按对齐的最大块放入空闲链表,相邻的块会合并
+		buddy_free_range(pool, page_index, count);
+	}
+	lock_init(&pool->lock);
+}
+
+// 记录可用物理内存区间[start, end),按页对齐并保持升序
+static void add_mem_range(uint32_t start, uint32_t end) {
+	start = (start + PAGE_SIZE - 1) & 0xfffff000;
+	end &= 0xfffff000;
+	if(start >= end || mem_range_count == MAX_MEM_RANGES) {
+		return;
 	}
-	for(uint32_t i = kern_pte_base, j = 0; i < kern_pte_count + kern_pte_base; i++, j++) {
-		pgd_kern[i] = V2P((uint32_t) pte_kern[j]) | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+	uint32_t i = mem_range_count++;
+	while(i > 0 && mem_ranges[i - 1].start > start) {
+		mem_ranges[i] = mem_ranges[i - 1];
+		--i;
 	}
-	// 其他页目录项最多 0-767
-	uint32_t other_pte_count = PAGE_PTE_COUNT - kern_pte_count;
-	for(uint32_t i = 0, j = kern_pte_count; i < other_pte_count; i++, j++) {
-		pgd_kern[i] = V2P((uint32_t) pte_kern[j]) | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+	mem_ranges[i].start = start;
+	mem_ranges[i].end = end;
+}
+
+// 根据multiboot信息探测可用物理内存,返回最高可用地址
+// 优先使用内存映射(mmap),跳过空洞和保留区,没有时退回到mem_upper
+static uint32_t detect_memory(void) {
+	struct multiboot *mboot = glb_mboot_ptr;
+	if(mboot->flags & MBOOT_FLAG_MMAP) {
+		// 引导程序把内存映射放在低端内存中,已被映射
+		uint32_t addr = mboot->mmap_addr;
+		while(addr < mboot->mmap_addr + mboot->mmap_length) {
+			struct mmap_entry *entry = (struct mmap_entry*) P2V(addr);
+			// 32位分页只能使用4GB以下的内存
+			if(entry->type == MMAP_TYPE_RAM && entry->base_addr_high == 0) {
+				uint64_t end = (uint64_t) entry->base_addr_low \
+					+ (((uint64_t) entry->length_high << 32) | entry->length_low);
+				if(end > 0xfffff000) {
+					end = 0xfffff000;
+				}
+				add_mem_range(entry->base_addr_low, (uint32_t) end);
+			}
+			// size不包括size字段本身
+			addr += entry->size + 4;
+		}
+	} else if(mboot->flags & MBOOT_FLAG_MEM) {
+		add_mem_range(0x100000, 0x100000 + mboot->mem_upper * 1024);
+	}
+	if(mem_range_count == 0) {
+		PANIC("detect_memory : no usable memory");
 	}
-	// 映射0-8MB内存
-	uint32_t *pte = (uint32_t*) pte_kern;
-	for(uint32_t i = 0; i < 2 * PAGE_PTE_SIZE; i++) {
-		pte[i] = (i << 12) | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+	uint32_t total = 0;
+	for(uint32_t i = 0; i < mem_range_count; i++) {
+		total += mem_ranges[i].end - mem_ranges[i].start;
 	}
-	__asm__ __volatile__("mov %0, %%cr3" : : "r"(V2P((uint32_t) pgd_kern)));
+	printk("usable memory : %dMB in %d ranges\n", total / 0x100000, mem_range_count);
+	return mem_ranges[mem_range_count - 1].end;
 }
 
 // 初始化物理内存管理
-static void init_mem_pool(uint32_t mem_size) {
-	// total memory, total pages
-	uint32_t total_mem_size = mem_size - KERNEL_END_PADDR;
-	uint32_t total_pages = total_mem_size / PAGE_SIZE;
-	
-	// -------- kernel_pool -----------
-	uint32_t kernel_pages = total_pages / 2;
-	uint32_t kernel_btmp_len = kernel_pages / 8;
-	
-	kernel_pool.paddr_start = KERNEL_END_PADDR;
-	kernel_pool.pool_size = kernel_pages * PAGE_SIZE;
-	kernel_pool.pool_btmp.byte_len = kernel_btmp_len;
-	kernel_pool.pool_btmp.bits = (void*) P2V(MM_BITMAP_PADDR);
-	
-	init_bitmap(&kernel_pool.pool_btmp);
-	
-	lock_init(&kernel_pool.lock);
-	
-	// -------- kernel_vaddr_pool -------------
-	kernel_vaddr_pool.vaddr_start = KERNEL_VADDR_START;
-	kernel_vaddr_pool.vaddr_btmp.byte_len = kernel_btmp_len;
-	kernel_vaddr_pool.vaddr_btmp.bits = (void*) P2V(MM_BITMAP_PADDR + kernel_btmp_len);
-	
-	init_bitmap(&kernel_vaddr_pool.vaddr_btmp);
-	
-	// -------- user_pool ---------------
-	uint32_t user_pages = total_pages - kernel_pages;
-	uint32_t user_btmp_len = user_pages / 8;
-	
-	user_pool.paddr_start = KERNEL_END_PADDR + kernel_pages * PAGE_SIZE;
-	user_pool.pool_size = user_pages * PAGE_SIZE;
-	user_pool.pool_btmp.byte_len = user_btmp_len;
-	user_pool.pool_btmp.bits = (void*) P2V(MM_BITMAP_PADDR + kernel_btmp_len * 2);
-	
-	init_bitmap(&user_pool.pool_btmp);
-	
-	lock_init(&user_pool.lock);
+// 先按最高可用地址建立mem_map,再把直接映射区内的内存交给kernel_pool,其余交给user_pool
+static void init_mem_pool(uint32_t mem_end) {
+	// 直接映射建立后,boot_alloc可以继续使用内核映像所在的可用区间
+	for(uint32_t i = 0; i < mem_range_count; i++) {
+		if(mem_ranges[i].start <= KERNEL_END_PADDR && mem_ranges[i].end > KERNEL_END_PADDR) {
+			boot_alloc_limit = mem_ranges[i].end < direct_map_size ? mem_ranges[i].end : direct_map_size;
+		}
+	}
+	max_pfn = mem_end / PAGE_SIZE;
+	mem_map = boot_alloc(max_pfn * sizeof(struct page));
+	for(uint32_t i = 0; i < max_pfn; i++) {
+		mem_map[i].flags = PG_RESERVED;
+	}
+	// 0-8MB用户可访问,不能分配给内存池,mem_map等元数据之后的内存才可分配
+	uint32_t pool_start = (V2P(boot_alloc_ptr) + PAGE_SIZE - 1) & 0xfffff000;
+	if(pool_start < KERNEL_END_PADDR) {
+		pool_start = KERNEL_END_PADDR;
+	}
+	// 之后不能再使用boot_alloc
+	boot_alloc_limit = 0;
+	uint32_t kernel_end = mem_end < direct_map_size ? mem_end : direct_map_size;
+	ASSERT(pool_start < kernel_end);
+	init_pool(&kernel_pool, pool_start, kernel_end);
+	init_pool(&user_pool, kernel_end, mem_end > kernel_end ? mem_end : kernel_end);
 }
 
 // kernel space virtual address to physic address
 uint32_t kern_v2p(uint32_t vaddr) {
-	uint32_t pgd_index = \
-		GET_PGD_INDEX(vaddr) - GET_PGD_INDEX(KERNEL_OFFSET);
-	uint32_t *pte = (uint32_t*) pte_kern[pgd_index];
-	uint32_t pte_index = GET_PTE_INDEX(vaddr);
-	return pte[pte_index];
+	ASSERT(vaddr >= KERNEL_OFFSET && V2P(vaddr) < direct_map_size);
+	return V2P(vaddr);
 }
 
-// 获取page_count个虚拟地址页(虚拟地址是连续的,可以分配多页)
-static void *get_vaddr(uint32_t page_count, enum pool_flag pf) {
+// 将物理页框paddr映射到临时映射区的第slot页,返回其虚拟地址
+// 每个slot同时只能有一个映射,调用者须关中断直到不再使用该映射
+void *kmap(uint32_t paddr, enum kmap_slot slot) {
+	ASSERT(get_intr_status() == INTR_OFF);
+	uint32_t vaddr = KMAP_VADDR + slot * PAGE_SIZE;
+	kmap_pte[slot] = (paddr & 0xfffff000) | PAGE_P_1 | PAGE_RW_W;
+	__asm__ __volatile__("invlpg (%0)" : : "r"(vaddr) : "memory");
+	return (void*) vaddr;
+}
+
+// 获取物理地址paddr所在页框的描述符
+struct page *paddr2page(uint32_t paddr) {
+	ASSERT(paddr / PAGE_SIZE < max_pfn);
+	return &mem_map[paddr / PAGE_SIZE];
+}
+
+// 获取内核堆虚拟地址vaddr所在页框的描述符
+struct page *kvaddr2page(void *vaddr) {
+	uint32_t paddr = kern_v2p((uint32_t) vaddr) & 0xfffff000;
+	ASSERT(paddr >= kernel_pool.paddr_start && \
+		paddr < kernel_pool.paddr_start + kernel_pool.pool_size);
+	return paddr2page(paddr);
+}
+
+// 在当前进程中获取page_count个虚拟地址页(虚拟地址是连续的,可以分配多页)
+// 内核空间使用直接映射,不需要分配虚拟地址
+static void *get_user_vaddr(uint32_t page_count) {
+	struct task_struct *pthread = current_thread();
+	return (void*) vma_alloc(&pthread->vma_list, page_count * PAGE_SIZE);
+}
+
+// 返回pf对应的物理内存池
+static struct memory_pool *pf2pool(enum pool_flag pf) {
 	ASSERT((pf == PF_KERNEL) || (pf == PF_USER));
-	int v_index;
-	uint32_t vaddr_start;
-	if(pf == PF_KERNEL) {
-		v_index = alloc_bitmap(&kernel_vaddr_pool.vaddr_btmp, page_count);
-		vaddr_start = kernel_vaddr_pool.vaddr_start;
-	} else if(pf == PF_USER) {
-		struct task_struct *pthread = current_thread();
-		v_index = alloc_bitmap(&pthread->prog_vaddr.vaddr_btmp, page_count);
-		vaddr_start = pthread->prog_vaddr.vaddr_start;
-		// USER_STACK3_VADDR是用户3级栈,已经被分配了
-		ASSERT((vaddr_start + v_index * PAGE_SIZE) < USER_STACK3_VADDR);
-	} else {
-		return NULL;
+	return pf == PF_KERNEL ? &kernel_pool : &user_pool;
+}
+
+// 从pool的预清零链表中取一个页框,返回其物理地址,没有时返回0
+// 调用者持有pool->lock
+static uint32_t zeroed_pop(struct memory_pool *pool) {
+	if(list_empty(&pool->zeroed)) {
+		return 0;
 	}
-	if(v_index == -1) {
-		return NULL;
+	struct page *page = ELE2ENTRY(struct page, free_ele, list_pop(&pool->zeroed));
+	--pool->zeroed_count;
+	return pool->paddr_start + (page - pool->pages) * PAGE_SIZE;
+}
+
+// 从pool中分配2^order个连续页框,失败时把预清零页框还给buddy系统后再试一次
+// 调用者持有pool->lock
+static int32_t pool_alloc(struct memory_pool *pool, uint32_t order) {
+	int32_t p_index = buddy_alloc(pool, order);
+	if(p_index == -1 && pool->zeroed_count > 0) {
+		uint32_t paddr;
+		while((paddr = zeroed_pop(pool)) != 0) {
+			buddy_free(pool, (paddr - pool->paddr_start) / PAGE_SIZE, 0);
+		}
+		p_index = buddy_alloc(pool, order);
 	}
-	return (void*) (vaddr_start + v_index * PAGE_SIZE);
+	return p_index;
 }
 
-// 获取一个物理地址页(物理地址可以不连续,故每次分配一页)
-static void *get_paddr(enum pool_flag pf) {
-	ASSERT((pf == PF_KERNEL) || (pf == PF_USER));
-	struct memory_pool *mem_pool;
-	if(pf == PF_KERNEL) {
+// 获取2^order个物理地址连续的页,返回起始物理地址
+// 用户内存池不足时从内核内存池借用,但要为内核保留一部分空闲页
+static void *get_paddr_block(enum pool_flag pf, uint32_t order) {
+	struct memory_pool *mem_pool = pf2pool(pf);
+	lock_acquire(&mem_pool->lock);
+	int32_t p_index = pool_alloc(mem_pool, order);
+	lock_release(&mem_pool->lock);
+	if(p_index == -1 && pf == PF_USER) {
 		mem_pool = &kernel_pool;
-	} else if(pf == PF_USER) {
+		lock_acquire(&mem_pool->lock);
+		if(mem_pool->free_pages >= (1U << order) + mem_pool->page_count / KERNEL_RESERVE_RATIO) {
+			p_index = pool_alloc(mem_pool, order);
+		}
+		lock_release(&mem_pool->lock);
+	}
+	if(p_index == -1) {
+		return NULL;
+	}
+	return (void*) (mem_pool->paddr_start + p_index * PAGE_SIZE);
+}
+
+// 返回物理地址paddr所属的内存池
+// 用户页可能借自内核内存池,按物理地址判断所属内存池
+static struct memory_pool *paddr2pool(uint32_t paddr) {
+	struct memory_pool *mem_pool = &kernel_pool;
+	if(paddr >= user_pool.paddr_start) {
 		mem_pool = &user_pool;
-	} else {
+	}
+	ASSERT(paddr >= mem_pool->paddr_start \
+		&& paddr < mem_pool->paddr_start + mem_pool->pool_size);
+	return mem_pool;
+}
+
+// 当前任务缓存pool中页框的magazine
+static struct magazine *frame_magazine(struct memory_pool *pool) {
+	return &current_thread()->mags.frames[pool == &kernel_pool ? 0 : 1];
+}
+
+// 从当前任务的magazine中取pf内存池的一个页框,返回物理地址,失败返回0
+// magazine空时加锁一次从内存池补充MAGAZINE_BATCH个
+// 关中断使中断处理程序不会同时修改当前任务的magazine
+static uint32_t mag_get_frame(enum pool_flag pf) {
+	if(!magazines_enabled) {
+		return 0;
+	}
+	struct memory_pool *pool = pf2pool(pf);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	struct magazine *mag = frame_magazine(pool);
+	if(mag->count == 0) {
+		lock_acquire(&pool->lock);
+		while(mag->count < MAGAZINE_BATCH) {
+			int32_t p_index = buddy_alloc(pool, 0);
+			if(p_index == -1) {
+				break;
+			}
+			mag->objs[mag->count++] = (void*) (pool->paddr_start + p_index * PAGE_SIZE);
+		}
+		lock_release(&pool->lock);
+	}
+	uint32_t paddr = 0;
+	if(mag->count > 0) {
+		paddr = (uint32_t) mag->objs[--mag->count];
+	}
+	set_intr_status(old_status);
+	return paddr;
+}
+
+// 将页框paddr放入当前任务的magazine,未启用magazine时返回false
+// magazine满时加锁一次归还MAGAZINE_BATCH个给内存池
+static bool mag_put_frame(uint32_t paddr) {
+	if(!magazines_enabled) {
+		return false;
+	}
+	struct memory_pool *pool = paddr2pool(paddr);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	struct magazine *mag = frame_magazine(pool);
+	if(mag->count == MAGAZINE_SIZE) {
+		lock_acquire(&pool->lock);
+		while(mag->count > MAGAZINE_SIZE - MAGAZINE_BATCH) {
+			uint32_t victim = (uint32_t) mag->objs[--mag->count];
+			buddy_free(pool, (victim - pool->paddr_start) / PAGE_SIZE, 0);
+		}
+		lock_release(&pool->lock);
+	}
+	mag->objs[mag->count++] = (void*) paddr;
+	set_intr_status(old_status);
+	return true;
+}
+
+// 获取一个物理地址页,优先从当前任务的magazine中取
+static void *get_paddr(enum pool_flag pf) {
+	uint32_t paddr = mag_get_frame(pf);
+	if(paddr != 0) {
+		return (void*) paddr;
+	}
+	return get_paddr_block(pf, 0);
+}
+
+// 将以paddr起始的2^order个物理页归还给所属的内存池,单个页框先放入当前任务的magazine
+static void free_paddr_block(uint32_t paddr, uint32_t order) {
+	struct memory_pool *mem_pool = paddr2pool(paddr);
+	if(order == 0 && mag_put_frame(paddr)) {
+		return;
+	}
+	lock_acquire(&mem_pool->lock);
+	buddy_free(mem_pool, (paddr - mem_pool->paddr_start) / PAGE_SIZE, order);
+	lock_release(&mem_pool->lock);
+}
+
+// 容纳page_count个页框所需的最小阶
+static uint32_t count2order(uint32_t page_count) {
+	uint32_t order = 0;
+	while((1U << order) < page_count) {
+		++order;
+	}
+	return order;
+}
+
+// 获取page_count个物理地址连续的页,返回起始物理地址
+// 块中超出page_count的尾部页框会立即归还
+static void *get_paddr_run(enum pool_flag pf, uint32_t page_count) {
+	if(page_count == 1) {
+		uint32_t paddr = mag_get_frame(pf);
+		if(paddr != 0) {
+			return (void*) paddr;
+		}
+	}
+	uint32_t order = count2order(page_count);
+	if(order >= MAX_ORDER) {
 		return NULL;
 	}
-	int p_index = alloc_bitmap(&mem_pool->pool_btmp, 1);
+	struct memory_pool *mem_pool = pf2pool(pf);
+	lock_acquire(&mem_pool->lock);
+	int32_t p_index = pool_alloc(mem_pool, order);
 	if(p_index == -1) {
+		lock_release(&mem_pool->lock);
 		return NULL;
 	}
+	// 把尾部多余的页框归还
+	buddy_free_range(mem_pool, p_index + page_count, (1 << order) - page_count);
+	lock_release(&mem_pool->lock);
 	return (void*) (mem_pool->paddr_start + p_index * PAGE_SIZE);
 }
 
-// 将虚拟地址vaddr映射到物理地址paddr
-static void vp_map(void *vaddr, void *paddr, enum pool_flag pf) {
-	ASSERT(vaddr != NULL && paddr != NULL);
-	ASSERT((pf == PF_KERNEL) || (pf == PF_USER));
-	uint32_t _vaddr = (uint32_t) vaddr;
-	uint32_t _paddr = (uint32_t) paddr;
-	uint32_t pgd_index;
-	if(pf == PF_KERNEL) {
-		_paddr |= (PAGE_P_1 | PAGE_RW_W);
-		pgd_index = GET_PGD_INDEX(_vaddr) - GET_PGD_INDEX(KERNEL_OFFSET);
-	} else if(pf == PF_USER) {
-		_paddr |= (PAGE_US_U | PAGE_P_1 | PAGE_RW_W);
-		pgd_index = GET_PGD_INDEX(_vaddr) + 256;
+// 减少用户页框paddr的引用计数,没有页表项再映射它时归还给用户内存池
+void put_user_page(uint32_t paddr) {
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	struct page *page = paddr2page(paddr);
+	ASSERT(page->ref_count > 0);
+	if(--page->ref_count == 0) {
+		page->flags &= ~PG_DIRTY;
+		free_paddr_block(paddr, 0);
+	}
+	set_intr_status(old_status);
+}
+
+// 解除页表项pte对页框的引用,共享映射的页被写入过时记在页框上,供写回文件
+static void put_user_pte(uint32_t pte) {
+	if((pte & PAGE_SHARED) && (pte & PAGE_D)) {
+		paddr2page(pte & 0xfffff000)->flags |= PG_DIRTY;
+	}
+	put_user_page(pte & 0xfffff000);
+}
+
+// 将物理页框paddr清0,不在直接映射区的页框通过临时映射区访问
+static void zero_frame(uint32_t paddr) {
+	if(paddr < direct_map_size) {
+		memset((void*) P2V(paddr), 0, PAGE_SIZE);
+		return;
+	}
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	memset(kmap(paddr, KMAP_ZERO), 0, PAGE_SIZE);
+	set_intr_status(old_status);
+}
+
+// 获取一个已清0的物理页,优先使用idle线程预先清0的页框,都没有时才同步清0
+static void *get_zeroed_paddr(enum pool_flag pf) {
+	struct memory_pool *mem_pool = pf2pool(pf);
+	lock_acquire(&mem_pool->lock);
+	uint32_t paddr = zeroed_pop(mem_pool);
+	lock_release(&mem_pool->lock);
+	if(paddr == 0 && pf == PF_USER && user_pool.free_pages == 0) {
+		// 用户内存池已耗尽,与get_paddr_block一样从内核内存池借用
+		lock_acquire(&kernel_pool.lock);
+		if(kernel_pool.free_pages >= kernel_pool.page_count / KERNEL_RESERVE_RATIO) {
+			paddr = zeroed_pop(&kernel_pool);
+		}
+		lock_release(&kernel_pool.lock);
+	}
+	if(paddr != 0) {
+		++zeroed_page_hits;
+		return (void*) paddr;
+	}
+	++zeroed_page_misses;
+	void *new_paddr = get_paddr(pf);
+	if(new_paddr != NULL) {
+		zero_frame((uint32_t) new_paddr);
+	}
+	return new_paddr;
+}
+
+// 为pool补充一个预清零页框,不需要补充,内存不足或锁被占用时返回false
+// 由idle线程调用,不能在锁上阻塞
+static bool zeroed_refill(struct memory_pool *pool) {
+	if(!lock_try_acquire(&pool->lock)) {
+		return false;
+	}
+	if(pool->zeroed_pending != 0) {
+		// 上次清0后没能放入zeroed的页框
+		struct page *page = paddr2page(pool->zeroed_pending);
+		list_push(&pool->zeroed, &page->free_ele);
+		++pool->zeroed_count;
+		pool->zeroed_pending = 0;
+		lock_release(&pool->lock);
+		return true;
+	}
+	int32_t p_index = -1;
+	// 空闲页不多时不再补充,以免与正常分配争抢
+	if(pool->zeroed_count < ZEROED_PAGES_MAX \
+		&& pool->free_pages > pool->page_count / KERNEL_RESERVE_RATIO) {
+		p_index = buddy_alloc(pool, 0);
+	}
+	lock_release(&pool->lock);
+	if(p_index == -1) {
+		return false;
+	}
+	// 清0期间不持有锁,分配者不必等待优先级最低的idle线程
+	zero_frame(pool->paddr_start + p_index * PAGE_SIZE);
+	if(!lock_try_acquire(&pool->lock)) {
+		// 不持有锁时不能操作buddy系统,先记下来,下次补充时再放入zeroed
+		pool->zeroed_pending = pool->paddr_start + p_index * PAGE_SIZE;
+		return false;
+	}
+	list_push(&pool->zeroed, &pool->pages[p_index].free_ele);
+	++pool->zeroed_count;
+	lock_release(&pool->lock);
+	return true;
+}
+
+// 补充一个预清零页框,所有内存池都已补满时返回false
+bool refill_zeroed_page(void) {
+	return zeroed_refill(&kernel_pool) || zeroed_refill(&user_pool);
+}
+
+// 返回pf内存池中的空闲页框数,包括预清零的页框
+uint32_t free_page_count(enum pool_flag pf) {
+	struct memory_pool *pool = pf2pool(pf);
+	return pool->free_pages + pool->zeroed_count;
+}
+
+// 用户进程虚拟地址vaddr对应的pte的虚拟地址
+// 进程页目录的最后一项指向页目录自身,故可通过0xffc00000访问当前进程的页表
+static uint32_t *pte_ptr(uint32_t vaddr) {
+	return (uint32_t*) (0xffc00000 + ((vaddr & 0xffc00000) >> 10) + GET_PTE_INDEX(vaddr) * 4);
+}
+
+// 当前进程虚拟地址vaddr对应的pde的虚拟地址
+static uint32_t *pde_ptr(uint32_t vaddr) {
+	return (uint32_t*) (0xfffff000 + GET_PGD_INDEX(vaddr) * 4);
+}
+
+// 页目录项pde所指页表的页框描述符,其ref_count是页表中已映射的页数
+static struct page *pt2page(uint32_t pde) {
+	return kvaddr2page((void*) P2V(pde & 0xfffff000));
+}
+
+// 页表中已没有映射时,回收当前进程虚拟地址vaddr所在的页表
+static void pt_release(uint32_t vaddr) {
+	uint32_t *pde = pde_ptr(vaddr);
+	if(pt2page(*pde)->ref_count > 0) {
+		return;
 	}
-	uint32_t pte_index = GET_PTE_INDEX(_vaddr);
-	pte_kern[pgd_index][pte_index] = _paddr;
+	kfree((void*) P2V(*pde & 0xfffff000), 1);
+	*pde = 0;
+	// 页表在自映射区中的地址也要从TLB中清除
+	__asm__ __volatile__("invlpg (%0)" : : "r"((uint32_t) pte_ptr(vaddr) & 0xfffff000) : "memory");
+	__asm__ __volatile__("invlpg (%0)" : : "r"(vaddr) : "memory");
 }
 
-// 解除虚拟地址vaddr和物理地址paddr的映射
+// 解除当前进程用户虚拟地址vaddr的映射,并回收物理页或交换槽,页表空了时一并回收
+// 虚拟内存区域由调用者取消预留
 static void vp_unmap(void *vaddr) {
 	ASSERT(vaddr != NULL);
 	uint32_t _vaddr = (uint32_t) vaddr;
-	uint32_t v_index = (_vaddr - kernel_vaddr_pool.vaddr_start) / PAGE_SIZE;
-	set_bitmap(&kernel_vaddr_pool.vaddr_btmp, v_index, 0);
-	struct memory_pool *mem_pool;
-	uint32_t pgd_index;
-	if(_vaddr >= KERNEL_VADDR_START) {
-		mem_pool = &kernel_pool;
-		pgd_index = GET_PGD_INDEX(_vaddr) - GET_PGD_INDEX(KERNEL_OFFSET);
-	} else if((_vaddr >= USER_VADDR_START) || (_vaddr < KERNEL_OFFSET)) {
-		mem_pool = &user_pool;
-		pgd_index = GET_PGD_INDEX(_vaddr) + 256;
+	ASSERT((_vaddr >= USER_VADDR_START) && (_vaddr < KERNEL_OFFSET));
+	uint32_t *pte = pte_ptr(_vaddr);
+	ASSERT(*pte & (PAGE_P_1 | PAGE_SWAP));
+	if(*pte & PAGE_P_1) {
+		put_user_pte(*pte);
+	} else {
+		swap_free(*pte >> 12);
 	}
-	uint32_t pte_index = GET_PTE_INDEX(_vaddr);
-	uint32_t p_index = (pte_kern[pgd_index][pte_index] - mem_pool->paddr_start) / PAGE_SIZE;
-	set_bitmap(&mem_pool->pool_btmp, p_index, 0);
-	pte_index = GET_PTE_INDEX(_vaddr);
-	pte_kern[pgd_index][pte_index] &= ~(PAGE_P_1);
+	*pte = 0;
 	// 清除TLB缓存
 	__asm__ __volatile__("invlpg (%0)" : : "r"(_vaddr) : "memory");
+	--pt2page(*pde_ptr(_vaddr))->ref_count;
+	pt_release(_vaddr);
+}
+
+// 当前进程的用户虚拟地址vaddr是否已映射物理页
+// 页表不存在时不能访问pte,需先检查pde
+bool prog_page_present(uint32_t vaddr) {
+	ASSERT(vaddr < KERNEL_OFFSET);
+	return (*pde_ptr(vaddr) & PAGE_P_1) && (*pte_ptr(vaddr) & PAGE_P_1);
+}
+
+// 当前进程的用户虚拟地址vaddr上的页是否已换出
+static bool prog_page_swapped(uint32_t vaddr) {
+	ASSERT(vaddr < KERNEL_OFFSET);
+	if(!(*pde_ptr(vaddr) & PAGE_P_1)) {
+		return false;
+	}
+	uint32_t pte = *pte_ptr(vaddr);
+	return !(pte & PAGE_P_1) && (pte & PAGE_SWAP);
 }
 
 // 分配size个页(4KB)的空间
+// 内核空间分配物理地址连续的页,通过直接映射访问
+// 用户空间只预留虚拟地址,物理页在首次访问时由page_fault_handler分配
 void *kmalloc(uint32_t size, enum pool_flag pf) {
 	ASSERT((pf == PF_KERNEL) || (pf == PF_USER));
-	void *vaddr = get_vaddr(size, pf);
-	if(vaddr == NULL) {
-		return NULL;
-	}
-	uint32_t count = size;
-	uint32_t _vaddr = (uint32_t) vaddr;
 	if(pf == PF_KERNEL) {
-		while(count-- > 0) {
-			void *paddr = get_paddr(pf);
-			if(paddr == NULL) {
-				if(count + 1 == size) { // 未分配任何物理页
-					return NULL;
-				} else { // 释放掉原来已分配的内存
-					uint32_t tmp_vaddr = (uint32_t) vaddr;
-					for(uint32_t i = 0; i < size - (count + 1); i++) {
-						vp_unmap((void*) tmp_vaddr);
-						tmp_vaddr += PAGE_SIZE;
-					}
-					return NULL;
-				}
-			}
-			vp_map((void*) _vaddr, paddr, pf);
-			_vaddr += PAGE_SIZE;
+		void *paddr = get_paddr_run(PF_KERNEL, size);
+		if(paddr == NULL) {
+			return NULL;
 		}
-		return vaddr;
-	} else if(pf == PF_USER) {
-		return get_prog_pages(_vaddr, size);
-	} else {
-		return NULL;
+		return (void*) P2V((uint32_t) paddr);
 	}
+	return get_user_vaddr(size);
 }
 
 // 释放以虚拟地址vaddr为起始的size个页框
 void kfree(void *vaddr, uint32_t size) {
 	ASSERT(vaddr != NULL);
 	uint32_t _vaddr = (uint32_t) vaddr;
+	if(_vaddr >= KERNEL_OFFSET) {
+		// 直接映射区,物理地址连续,整段归还给内核内存池
+		uint32_t paddr = kern_v2p(_vaddr);
+		ASSERT(paddr >= kernel_pool.paddr_start \
+			&& paddr + size * PAGE_SIZE <= kernel_pool.paddr_start + kernel_pool.pool_size);
+		if(size == 1 && mag_put_frame(paddr)) {
+			return;
+		}
+		lock_acquire(&kernel_pool.lock);
+		buddy_free_range(&kernel_pool, (paddr - kernel_pool.paddr_start) / PAGE_SIZE, size);
+		lock_release(&kernel_pool.lock);
+		return;
+	}
+	// 用户地址只属于当前进程,从未访问过的页没有映射
+	struct task_struct *cur_thread = current_thread();
+	if(!vma_free(&cur_thread->vma_list, _vaddr, _vaddr + size * PAGE_SIZE)) {
+		// 拆分区域失败时地址保持预留,只回收物理页
+		printk("kfree : vma_free failed, %x remains reserved\n", _vaddr);
+	}
 	while(size-- > 0) {
-		vp_unmap((void*) _vaddr);
+		if(prog_page_present(_vaddr) || prog_page_swapped(_vaddr)) {
+			vp_unmap((void*) _vaddr);
+		}
 		_vaddr += PAGE_SIZE;
 	}
 }
 
 // 在内核物理内存池中申请size个物理页,并返回虚拟地址
 void *get_kernel_pages(uint32_t size) {
-	lock_acquire(&kernel_pool.lock);
-	void *vaddr = kmalloc(size, PF_KERNEL);
-	lock_release(&kernel_pool.lock);
-	return vaddr;
+	return kmalloc(size, PF_KERNEL);
+}
+
+// 在内核物理内存池中申请一个已清0的物理页,并返回虚拟地址
+void *get_zeroed_kernel_page(void) {
+	void *paddr = get_zeroed_paddr(PF_KERNEL);
+	if(paddr == NULL) {
+		return NULL;
+	}
+	return (void*) P2V((uint32_t) paddr);
+}
+
+// 将物理页paddr映射到当前进程的虚拟地址vaddr,flags为附加的页表项标志
+// 页表不存在时一并创建,页表来自内核内存池,可通过直接映射访问其他进程的页表
+// 同一页表中的页共用该页表,页表的引用计数是其中已映射的页数
+// 页框的引用计数由调用者维护
+bool prog_page_map(uint32_t vaddr, uint32_t paddr, uint32_t flags) {
+	uint32_t *pde = pde_ptr(vaddr);
+	uint32_t *pte = pte_ptr(vaddr);
+	if(!(*pde & PAGE_P_1)) {
+		uint32_t *pt = get_zeroed_kernel_page();
+		if(pt == NULL) {
+			return false;
+		}
+		kvaddr2page(pt)->ref_count = 0;
+		*pde = V2P((uint32_t) pt) | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+		__asm__ __volatile__("invlpg (%0)" : : "r"((uint32_t) pte & 0xfffff000) : "memory");
+	}
+	ASSERT(!(*pte & PAGE_P_1));
+	*pte = paddr | flags | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+	++pt2page(*pde)->ref_count;
+	return true;
+}
+
+// 获取一个用户页框,zeroed为true时页框已清0
+// 内存不足时换出一些用户页后再试一次
+void *get_user_frame(bool zeroed) {
+	void *paddr = zeroed ? get_zeroed_paddr(PF_USER) : get_paddr(PF_USER);
+	if(paddr == NULL && swap_out(SWAP_CLUSTER) > 0) {
+		paddr = zeroed ? get_zeroed_paddr(PF_USER) : get_paddr(PF_USER);
+	}
+	return paddr;
+}
+
+// 为当前进程的虚拟地址vaddr分配一个已清0的物理页并建立映射
+static bool user_page_map(uint32_t vaddr) {
+	void *paddr = get_user_frame(true);
+	if(paddr == NULL) {
+		return false;
+	}
+	if(!prog_page_map(vaddr, (uint32_t) paddr, 0)) {
+		free_paddr_block((uint32_t) paddr, 0);
+		return false;
+	}
+	paddr2page((uint32_t) paddr)->ref_count = 1;
+	return true;
 }
 
 // 获取进程从虚拟地址vaddr开始的size个物理页,并返回虚拟地址
 void *get_prog_pages(uint32_t vaddr, uint32_t size) {
 	ASSERT((vaddr >= USER_VADDR_START) || (vaddr < KERNEL_OFFSET));
 	struct task_struct *cur_thread = current_thread();
-	uint32_t *pgd = (uint32_t*) cur_thread->pgdir;
+	if(!vma_reserve(&cur_thread->vma_list, vaddr, vaddr + size * PAGE_SIZE)) {
+		return NULL;
+	}
 	uint32_t _vaddr = vaddr;
-	uint32_t pgd_index;
-	uint32_t pte_index;
-	while(size-- > 0) {
-		// 设置进程虚拟位图
-		set_bitmap(&cur_thread->prog_vaddr.vaddr_btmp, \
-			(_vaddr - cur_thread->prog_vaddr.vaddr_start) / PAGE_SIZE, 1);
-		pgd_index = GET_PGD_INDEX(_vaddr);
-		pte_index = GET_PTE_INDEX(_vaddr);
-		lock_acquire(&kernel_pool.lock);
-		void *tmp_vaddr = get_vaddr(1, PF_KERNEL);
-		void *tmp_paddr = get_paddr(PF_KERNEL);
-		vp_map(tmp_vaddr, tmp_paddr, PF_KERNEL);
-		lock_release(&kernel_pool.lock);
-		pgd[pgd_index] = (uint32_t) tmp_paddr | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
-		((uint32_t*) tmp_vaddr)[pte_index] = \
-			(uint32_t) get_paddr(PF_USER) | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
-		// 解除tmp_vaddr和tmp_paddr的映射
-		set_bitmap(&kernel_vaddr_pool.vaddr_btmp, 
-			((uint32_t) tmp_vaddr - kernel_vaddr_pool.vaddr_start) / PAGE_SIZE, 0);
-		pgd_index = GET_PGD_INDEX((uint32_t) tmp_vaddr) - GET_PGD_INDEX(KERNEL_OFFSET);
-		pte_index = GET_PTE_INDEX((uint32_t) tmp_vaddr);
-		pte_kern[pgd_index][pte_index] &= ~(PAGE_P_1);
-		// 清除TLB缓存
-		__asm__ __volatile__("invlpg (%0)" : : "r"((uint32_t) tmp_vaddr) : "memory");
+	for(uint32_t i = 0; i < size; i++) {
+		if(!user_page_map(_vaddr)) {
+			// 释放已映射的页,kfree会同时取消预留
+			kfree((void*) vaddr, size);
+			return NULL;
+		}
 		_vaddr += PAGE_SIZE;
 	}
 	return (void*) vaddr;
 }
 
-// 获取进程虚拟地址vaddr的一个物理页,但不修改虚拟位图
-void *get_page_without_btmp(uint32_t vaddr) {
-	ASSERT((vaddr >= USER_VADDR_START) || (vaddr < KERNEL_OFFSET));
-	uint32_t *pgd = (uint32_t*)((0xfffff000) + GET_PGD_INDEX(vaddr) * 4);
-	lock_acquire(&kernel_pool.lock);
-	void *tmp_vaddr = get_vaddr(1, PF_KERNEL);
-	void *tmp_paddr = get_paddr(PF_KERNEL);
-	vp_map(tmp_vaddr, tmp_paddr, PF_KERNEL);
-	lock_release(&kernel_pool.lock);
-	*pgd = (uint32_t) tmp_paddr | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
-	((uint32_t*) tmp_vaddr)[GET_PTE_INDEX(vaddr)] = \
-		(uint32_t) get_paddr(PF_USER) | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
-	// 解除tmp_vaddr和tmp_paddr的映射
-	set_bitmap(&kernel_vaddr_pool.vaddr_btmp, 
-		((uint32_t) tmp_vaddr - kernel_vaddr_pool.vaddr_start) / PAGE_SIZE, 0);
-	// 清除TLB缓存
-	__asm__ __volatile__("invlpg (%0)" : : "r"((uint32_t) tmp_vaddr) : "memory");
-	return vaddr;
+// 以写时复制的方式将页目录pgdir的第pde_index个页表复制到child_pgdir
+static bool copy_page_table(uint32_t *pgdir, uint32_t *child_pgdir, uint32_t pde_index) {
+	if(!(pgdir[pde_index] & PAGE_P_1)) {
+		return true;
+	}
+	uint32_t *pt = (uint32_t*) P2V(pgdir[pde_index] & 0xfffff000);
+	uint32_t *child_pt = get_kernel_pages(1);
+	if(child_pt == NULL) {
+		return false;
+	}
+	for(uint32_t j = 0; j < PAGE_PTE_SIZE; j++) {
+		if(pt[j] & PAGE_P_1) {
+			// 共享映射的页父子进程都可写
+			if((pt[j] & PAGE_RW_W) && !(pt[j] & PAGE_SHARED)) {
+				pt[j] = (pt[j] & ~PAGE_RW_W) | PAGE_COW;
+			}
+			++paddr2page(pt[j] & 0xfffff000)->ref_count;
+		} else if(pt[j] & PAGE_SWAP) {
+			// 已换出的页由父子进程共享交换槽
+			swap_dup(pt[j] >> 12);
+		}
+		child_pt[j] = pt[j];
+	}
+	// 子进程页表中的映射与父进程相同
+	kvaddr2page(child_pt)->ref_count = pt2page(pgdir[pde_index])->ref_count;
+	child_pgdir[pde_index] = V2P((uint32_t) child_pt) | (pgdir[pde_index] & 0xfff);
+	return true;
+}
+
+// 以写时复制的方式将当前进程的用户页共享给页目录为child_pgdir的子进程
+// 只复制vma_list中各区域所在的页表,父子进程的页表项都改为只读并标记PAGE_COW,
+// 页框引用计数加1,任一方写入时再由page_fault_handler复制该页
+// 共享映射(PAGE_SHARED)的页保持可写,父子进程始终共享
+bool copy_prog_pages(uint32_t *child_pgdir) {
+	struct task_struct *cur_thread = current_thread();
+	uint32_t *pgdir = cur_thread->pgdir;
+	ASSERT(pgdir != NULL && get_intr_status() == INTR_OFF);
+	// 相邻的区域可能落在同一个页表中,next_pde之前的页表已复制过
+	uint32_t next_pde = 0;
+	struct list_ele *ele = cur_thread->vma_list.head.next;
+	while(ele != &cur_thread->vma_list.tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		uint32_t pde_index = GET_PGD_INDEX(vma->start);
+		uint32_t pde_last = GET_PGD_INDEX(vma->end - 1);
+		if(pde_index < next_pde) {
+			pde_index = next_pde;
+		}
+		while(pde_index <= pde_last) {
+			if(!copy_page_table(pgdir, child_pgdir, pde_index)) {
+				return false;
+			}
+			++pde_index;
+		}
+		next_pde = pde_last + 1;
+		ele = ele->next;
+	}
+	// 父进程的页表项已改为只读,重新加载cr3清除TLB中的用户页
+	__asm__ __volatile__("mov %0, %%cr3" : : "r"(kern_v2p((uint32_t) pgdir)) : "memory");
+	return true;
+}
+
+// 回收进程pthread的用户空间,包括所有用户页,页表和虚拟内存区域
+// 页表通过直接映射访问,pthread不必是当前进程;
+// 若是当前进程,此后不能再访问用户空间
+void release_prog_space(struct task_struct *pthread) {
+	uint32_t *pgdir = pthread->pgdir;
+	ASSERT(pgdir != NULL);
+	uint32_t next_pde = 0;
+	struct list_ele *ele = pthread->vma_list.head.next;
+	while(ele != &pthread->vma_list.tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		uint32_t pde_index = GET_PGD_INDEX(vma->start);
+		uint32_t pde_last = GET_PGD_INDEX(vma->end - 1);
+		if(pde_index < next_pde) {
+			pde_index = next_pde;
+		}
+		while(pde_index <= pde_last) {
+			if(pgdir[pde_index] & PAGE_P_1) {
+				// 先清除页表项再归还,归还时可能阻塞,换出的时钟扫描不能再看到这些页
+				uint32_t *pt = (uint32_t*) P2V(pgdir[pde_index] & 0xfffff000);
+				pgdir[pde_index] = 0;
+				for(uint32_t j = 0; j < PAGE_PTE_SIZE; j++) {
+					uint32_t pte = pt[j];
+					pt[j] = 0;
+					if(pte & PAGE_P_1) {
+						put_user_pte(pte);
+					} else if(pte & PAGE_SWAP) {
+						swap_free(pte >> 12);
+					}
+				}
+				kvaddr2page(pt)->ref_count = 0;
+				kfree(pt, 1);
+			}
+			++pde_index;
+		}
+		next_pde = pde_last + 1;
+		ele = ele->next;
+	}
+	// 写回已没有进程映射的共享文件页
+	mmap_trim();
+	vma_destroy(&pthread->vma_list);
+}
+
+// 处理写时复制页vaddr上的写错误
+// 页框仍被共享时复制到新页框,已无其他进程共享时直接恢复可写
+static bool copy_on_write(uint32_t vaddr) {
+	uint32_t *pte = pte_ptr(vaddr);
+	struct page *page = paddr2page(*pte & 0xfffff000);
+	if(page->ref_count == 1) {
+		*pte = (*pte & ~PAGE_COW) | PAGE_RW_W;
+	} else {
+		void *paddr = get_user_frame(false);
+		if(paddr == NULL) {
+			return false;
+		}
+		// 新页框还没有映射,通过临时映射区写入
+		memcpy(kmap((uint32_t) paddr, KMAP_COW), (void*) vaddr, PAGE_SIZE);
+		paddr2page((uint32_t) paddr)->ref_count = 1;
+		--page->ref_count;
+		*pte = (uint32_t) paddr | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+	}
+	__asm__ __volatile__("invlpg (%0)" : : "r"(vaddr) : "memory");
+	return true;
 }
 
 // 初始化内存块描述符
@@ -314,7 +1000,7 @@ void init_block_desc(struct mem_block_desc *desc_arr) {
 	for(uint8_t i = 0; i < MEM_BLOCK_DESC_COUNT; i++) {
 		desc_arr[i].block_size = block_size;
 		desc_arr[i].block_count = (PAGE_SIZE - sizeof(struct arena)) / block_size;
-		list_init(&desc_arr[i].free_list);
+		list_init(&desc_arr[i].partial_list);
 		block_size *= 2;
 	}
 }
@@ -330,128 +1016,381 @@ static struct arena *block2arena(struct mem_block *block) {
 	return (struct arena*) ((uint32_t) block & 0xfffff000);
 }
 
-// 在堆中申请size字节内存
-void *sys_malloc(uint32_t size) {
-	enum pool_flag pf;
-	struct memory_pool *mem_pool;
-	uint32_t pool_size;
-	struct mem_block_desc *descs;
-	struct task_struct *cur_thread = current_thread();
-	// 判断用哪个内存池
-	if(cur_thread->pgdir == NULL) { // 内核线程
-		pf = PF_KERNEL;
-		mem_pool = &kernel_pool;
-		pool_size = kernel_pool.pool_size;
-		descs = kernel_block_descs;
-	} else { // 用户进程
-		pf = PF_USER;
-		mem_pool = &user_pool;
-		pool_size = user_pool.pool_size;
-		descs = cur_thread->prog_block_descs;
+#ifdef MM_DEBUG
+// 检查block是否是arena中合法的已分配内存块
+static void heap_check_block(struct arena *arena, struct mem_block *block) {
+	uint32_t offset = (uint32_t) block - (uint32_t) arena2block(arena, 0);
+	ASSERT(offset % arena->desc->block_size == 0);
+	ASSERT(offset / arena->desc->block_size < arena->carved);
+	ASSERT(arena->count < arena->desc->block_count);
+	// 重复释放的内存块已经在空闲链表中
+	uint32_t free_count = 0;
+	struct mem_block *tmp = arena->free_blocks;
+	while(tmp != NULL) {
+		ASSERT(tmp != block);
+		ASSERT(block2arena(tmp) == arena);
+		tmp = tmp->next;
+		++free_count;
 	}
-	// 若申请的内存不在内存池容量范围内,直接返回NULL
-	if(size <= 0 || size >= pool_size) {
-		return NULL;
+	ASSERT(free_count + arena->desc->block_count - arena->carved == arena->count);
+}
+#endif
+
+// 分配page_count个页作为arena
+static struct arena *arena_alloc(uint32_t page_count, enum pool_flag pf) {
+	if(pf == PF_KERNEL) {
+		return get_kernel_pages(page_count);
 	}
+	return kmalloc(page_count, PF_USER);
+}
+
+// 从内存块描述符数组descs中分配size字节,页从pf内存池获取
+// 调用者负责descs的互斥
+static void *heap_alloc(struct mem_block_desc *descs, enum pool_flag pf, uint32_t size) {
 	struct arena *arena;
 	struct mem_block *block;
-	lock_acquire(&mem_pool->lock);
 	if(size > 1024) { // 超过最大内存块1024,则分配页框
 		uint32_t page_count = DIV_ROUND_UP(size + sizeof(struct arena), PAGE_SIZE);
-		arena = kmalloc(page_count, pf);
-		if(arena != NULL) {
-			memset(arena, 0, page_count * PAGE_SIZE); // 将分配的内存清0
-			arena->desc = NULL;
-			arena->count = page_count;
-			arena->large = true;
-			lock_release(&mem_pool->lock);
-			return (void*) (arena + 1); // 跨过arena大小,把剩下的内存返回
+		// 将分配的内存清0,用户页在首次访问时映射的就是已清0的页框
+		if(pf == PF_KERNEL && page_count == 1) {
+			arena = get_zeroed_kernel_page();
 		} else {
-			lock_release(&mem_pool->lock);
+			arena = arena_alloc(page_count, pf);
+			if(arena != NULL && pf == PF_KERNEL) {
+				memset(arena, 0, page_count * PAGE_SIZE);
+			}
+		}
+		if(arena == NULL) {
+			return NULL;
+		}
+		arena->desc = NULL;
+		arena->count = page_count;
+		arena->large = true;
+		return (void*) (arena + 1); // 跨过arena大小,把剩下的内存返回
+	}
+	// 小于等于1024,根据mem_block_desc分配
+	uint8_t desc_index;
+	for(desc_index = 0; desc_index < MEM_BLOCK_DESC_COUNT; desc_index++) {
+		if(size <= descs[desc_index].block_size) {
+			break;
+		}
+	}
+	struct mem_block_desc *desc = &descs[desc_index];
+	// 没有还有空闲块的arena时,创建新的arena
+	// 新arena中的内存块不预先串成链表,而是在分配时按carved顺序切出
+	if(list_empty(&desc->partial_list)) {
+		arena = arena_alloc(1, pf); // 分配一个页框
+		if(arena == NULL) {
 			return NULL;
 		}
-	} else { // 小于等于1024,根据mem_block_desc分配
-		uint8_t desc_index;
-		for(desc_index = 0; desc_index < MEM_BLOCK_DESC_COUNT; desc_index++) {
-			if(size <= descs[desc_index].block_size) {
+		arena->desc = desc;
+		arena->large = false;
+		arena->count = desc->block_count;
+		arena->carved = 0;
+		arena->free_blocks = NULL;
+		list_append(&desc->partial_list, &arena->partial_tag);
+	} else {
+		arena = ELE2ENTRY(struct arena, partial_tag, desc->partial_list.head.next);
+	}
+	// 优先复用释放过的内存块
+	if(arena->free_blocks != NULL) {
+		block = arena->free_blocks;
+		arena->free_blocks = block->next;
+	} else {
+		ASSERT(arena->carved < desc->block_count);
+		block = arena2block(arena, arena->carved++);
+	}
+	// arena中已无空闲块,移出partial_list
+	if(--arena->count == 0) {
+		list_remove(&arena->partial_tag);
+	}
+	memset(block, 0, desc->block_size);
+	return (void*) block;
+}
+
+// 回收heap_alloc分配的内存ptr,调用者负责互斥
+static void heap_free(void *ptr) {
+	struct mem_block *block = ptr;
+	struct arena *arena = block2arena(block);
+	ASSERT((arena->large == true) || (arena->large == false));
+	if(arena->desc == NULL  && arena->large == true) { // 大于1024的内存
+		kfree(arena, arena->count);
+		return;
+	}
+	// 小于等于1024的内存块
+#ifdef MM_DEBUG
+	heap_check_block(arena, block);
+#endif
+	// arena原先已满,重新加入partial_list
+	if(arena->count++ == 0) {
+		list_append(&arena->desc->partial_list, &arena->partial_tag);
+	}
+	// arena中的内存块全部空闲,直接释放整个arena
+	if(arena->count == arena->desc->block_count) {
+		list_remove(&arena->partial_tag);
+		kfree(arena, 1);
+		return;
+	}
+	block->next = arena->free_blocks;
+	arena->free_blocks = block;
+}
+
+// 从当前任务的magazine中取一个kernel_block_descs[desc_index]规格的内存块,失败返回NULL
+// magazine空时加锁一次从内核堆补充MAGAZINE_BATCH个
+// magazine中的内存块都已清0:从内核堆补充的由heap_alloc清0,归还的由mag_put_block清0
+static void *mag_get_block(uint32_t desc_index) {
+	struct mem_block_desc *desc = &kernel_block_descs[desc_index];
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	struct magazine *mag = &current_thread()->mags.blocks[desc_index];
+	if(mag->count == 0) {
+		lock_acquire(&kernel_heap_lock);
+		while(mag->count < MAGAZINE_BATCH) {
+			void *block = heap_alloc(kernel_block_descs, PF_KERNEL, desc->block_size);
+			if(block == NULL) {
 				break;
 			}
+			mag->objs[mag->count++] = block;
 		}
-		// 若mem_block_desc的free_list为空,则创建新的arena提供mem_block
-		if(list_empty(&descs[desc_index].free_list)) {
-			arena = kmalloc(1, pf); // 分配一个页框
-			if(arena == NULL) {
-				lock_release(&mem_pool->lock);
-				return NULL;
-			}
-			memset(arena, 0, PAGE_SIZE);
-			arena->desc = &descs[desc_index];
-			arena->large = false;
-			arena->count = descs[desc_index].block_count;
-			// 拆分arena成mem_block,并添加到free_list中
-			enum intr_status old_status = get_intr_status();
-			disable_intr();
-			for(uint32_t i = 0; i < descs[desc_index].block_count; i++) {
-				block = arena2block(arena, i);
-				ASSERT(!list_find(&arena->desc->free_list, &block->free_ele));
-				list_append(&arena->desc->free_list, &block->free_ele);
-			}
-			set_intr_status(old_status);
-		}
-		// 开始分配内存块
-		block = ELE2ENTRY(struct mem_block, free_ele, \
-			list_pop(&(descs[desc_index].free_list)));
-		memset(block, 0, descs[desc_index].block_size);
-		arena = block2arena(block);
-		--arena->count;
-		lock_release(&mem_pool->lock);
-		return (void*) block;
+		lock_release(&kernel_heap_lock);
 	}
+	void *block = NULL;
+	if(mag->count > 0) {
+		block = mag->objs[--mag->count];
+	}
+	set_intr_status(old_status);
+	return block;
 }
 
-// 回收内存ptr
+// 将内核内存块ptr放入当前任务的magazine,大块内存或未启用magazine时返回false
+// magazine满时加锁一次归还MAGAZINE_BATCH个给内核堆
+static bool mag_put_block(void *ptr) {
+	struct arena *arena = block2arena(ptr);
+	if(!magazines_enabled || arena->large) {
+		return false;
+	}
+	memset(ptr, 0, arena->desc->block_size);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	struct magazine *mag = &current_thread()->mags.blocks[arena->desc - kernel_block_descs];
+	if(mag->count == MAGAZINE_SIZE) {
+		lock_acquire(&kernel_heap_lock);
+		while(mag->count > MAGAZINE_SIZE - MAGAZINE_BATCH) {
+			heap_free(mag->objs[--mag->count]);
+		}
+		lock_release(&kernel_heap_lock);
+	}
+	mag->objs[mag->count++] = ptr;
+	set_intr_status(old_status);
+	return true;
+}
+
+// 将mags中缓存的页框和内存块全部归还,任务被回收前调用
+void magazines_drain(struct task_magazines *mags) {
+	struct memory_pool *pools[2] = {&kernel_pool, &user_pool};
+	for(uint32_t i = 0; i < 2; i++) {
+		struct magazine *mag = &mags->frames[i];
+		lock_acquire(&pools[i]->lock);
+		while(mag->count > 0) {
+			uint32_t paddr = (uint32_t) mag->objs[--mag->count];
+			buddy_free(pools[i], (paddr - pools[i]->paddr_start) / PAGE_SIZE, 0);
+		}
+		lock_release(&pools[i]->lock);
+	}
+	lock_acquire(&kernel_heap_lock);
+	for(uint32_t i = 0; i < MEM_BLOCK_DESC_COUNT; i++) {
+		struct magazine *mag = &mags->blocks[i];
+		while(mag->count > 0) {
+			heap_free(mag->objs[--mag->count]);
+		}
+	}
+	lock_release(&kernel_heap_lock);
+}
+
+// 在内核堆中申请size字节内存,与调用者是线程还是进程无关
+// 不超过1024字节时优先从当前任务的magazine中取
+void *kernel_malloc(uint32_t size) {
+	if(size == 0 || size >= kernel_pool.pool_size) {
+		return NULL;
+	}
+	if(size <= 1024 && magazines_enabled) {
+		uint32_t desc_index = 0;
+		while(size > kernel_block_descs[desc_index].block_size) {
+			++desc_index;
+		}
+		void *ptr = mag_get_block(desc_index);
+		if(ptr != NULL) {
+			return ptr;
+		}
+	}
+	lock_acquire(&kernel_heap_lock);
+	void *ptr = heap_alloc(kernel_block_descs, PF_KERNEL, size);
+	lock_release(&kernel_heap_lock);
+	return ptr;
+}
+
+// 回收kernel_malloc分配的内存ptr
+void kernel_free(void *ptr) {
+	ASSERT(ptr != NULL && (uint32_t) ptr >= KERNEL_OFFSET);
+	if(mag_put_block(ptr)) {
+		return;
+	}
+	lock_acquire(&kernel_heap_lock);
+	heap_free(ptr);
+	lock_release(&kernel_heap_lock);
+}
+
+// 在当前进程的用户堆中申请size字节内存
+// 用户堆只被所属进程访问,无需加锁
+void *user_malloc(uint32_t size) {
+	struct task_struct *cur_thread = current_thread();
+	ASSERT(cur_thread->pgdir != NULL);
+	if(size == 0 || size >= user_pool.pool_size + kernel_pool.pool_size) {
+		return NULL;
+	}
+	return heap_alloc(cur_thread->prog_block_descs, PF_USER, size);
+}
+
+// 回收user_malloc分配的内存ptr
+void user_free(void *ptr) {
+	ASSERT(ptr != NULL && (uint32_t) ptr < KERNEL_OFFSET);
+	ASSERT(current_thread()->pgdir != NULL);
+	heap_free(ptr);
+}
+
+// 在堆中申请size字节内存,内核线程使用内核堆,用户进程使用用户堆
+void *sys_malloc(uint32_t size) {
+	if(current_thread()->pgdir == NULL) {
+		return kernel_malloc(size);
+	}
+	return user_malloc(size);
+}
+
+// 回收内存ptr,按地址判断属于内核堆还是用户堆
 void sys_free(void *ptr) {
 	ASSERT(ptr != NULL);
 	if(ptr != NULL) {
-		enum pool_flag pf;
-		struct memory_pool *mem_pool;
-		if(current_thread()->pgdir == NULL) { // 内核线程
-			ASSERT((uint32_t) ptr >= KERNEL_VADDR_START);
-			pf = PF_KERNEL;
-			mem_pool = &kernel_pool;
-		} else { // 用户进程
-			pf = PF_USER;
-			mem_pool = &user_pool;
+		if((uint32_t) ptr >= KERNEL_OFFSET) {
+			kernel_free(ptr);
+		} else {
+			user_free(ptr);
 		}
-		lock_acquire(&mem_pool->lock);
-		struct mem_block *block = ptr;
-		struct arena *arena = block2arena(block);
-		ASSERT((arena->large == true) || (arena->large == false));
-		if(arena->desc == NULL  && arena->large == true) { // 大于1024的内存
-			kfree(arena, arena->count);
-		} else { // 小于等于1024的内存块
-			// 先将内存块回收到free_list
-			list_append(&arena->desc->free_list, &block->free_ele);
-			// 再判断arena中的内存块是否都是空闲,如果是则释放
-			if(++arena->count == arena->desc->block_count) {
-				for(uint32_t i = 0; i < arena->desc->block_count; i++) {
-					struct mem_block *block_tmp = arena2block(arena, i);
-					ASSERT(list_find(&arena->desc->free_list, &block_tmp->free_ele));
-					list_remove(&block_tmp->free_ele);
-				}
-				kfree(arena, 1);
+	}
+}
+
+// 将当前进程的堆末尾设为new_brk,返回设置后的堆末尾
+// new_brk为0或设置失败时堆不变,返回当前的堆末尾
+uint32_t sys_brk(uint32_t new_brk) {
+	struct task_struct *cur_thread = current_thread();
+	if(cur_thread->pgdir == NULL) {
+		return 0;
+	}
+	// 堆的第一页留给用户态malloc,堆不能伸入用户栈
+	if(new_brk < USER_HEAP_VADDR + PAGE_SIZE || new_brk > KERNEL_OFFSET - USER_STACK_SIZE) {
+		return cur_thread->brk;
+	}
+	uint32_t old_end = (cur_thread->brk + PAGE_SIZE - 1) & 0xfffff000;
+	uint32_t new_end = (new_brk + PAGE_SIZE - 1) & 0xfffff000;
+	if(new_end > old_end) {
+		// 只预留地址,物理页在首次访问时分配
+		if(!vma_reserve(&cur_thread->vma_list, old_end, new_end)) {
+			return cur_thread->brk;
+		}
+	} else if(new_end < old_end) {
+		kfree((void*) new_end, (old_end - new_end) / PAGE_SIZE);
+	}
+	cur_thread->brk = new_brk;
+	return new_brk;
+}
+
+// 将当前进程的堆扩展increment字节(可以为负),返回扩展前的堆末尾,失败返回-1
+void *sys_sbrk(int32_t increment) {
+	uint32_t old_brk = current_thread()->brk;
+	if(increment != 0 && sys_brk(old_brk + increment) != old_brk + increment) {
+		return (void*) -1;
+	}
+	return (void*) old_brk;
+}
+
+// 将当前进程已换出的页vaddr读回新页框并恢复映射
+static bool swap_in(uint32_t vaddr) {
+	uint32_t *pte = pte_ptr(vaddr);
+	uint32_t entry = *pte;
+	void *paddr = get_user_frame(false);
+	if(paddr == NULL) {
+		return false;
+	}
+	swap_read(entry >> 12, (uint32_t) paddr);
+	// 换出只处理已映射的页,读入期间此页表项不会改变
+	ASSERT(*pte == entry);
+	paddr2page((uint32_t) paddr)->ref_count = 1;
+	*pte = (uint32_t) paddr | PAGE_US_U | PAGE_P_1 | PAGE_RW_W;
+	swap_free(entry >> 12);
+	return true;
+}
+
+// 页错误处理函数
+// 访问已预留(在vma_list的某个区域中)但还未映射的用户页时,分配物理页并清0,
+// 用户栈和用户堆都按此方式在首次访问时才占用物理页,
+// mmap映射的区域同样在首次访问时才从文件读入,已换出的页再次访问时换入,
+// 写入写时复制页时复制该页
+// 中断入口压入的vec_no是intr_stack的第一个成员,故其地址就是intr_stack的地址
+static void page_fault_handler(uint32_t vec_no) {
+	struct intr_stack *stack = (struct intr_stack*) &vec_no;
+	uint32_t vaddr;
+	__asm__ __volatile__("movl %%cr2, %0" : "=r"(vaddr));
+	struct task_struct *cur_thread = current_thread();
+	struct vm_area *vma;
+	if((stack->err_code & PF_ERR_P) && (stack->err_code & PF_ERR_W) \
+		&& cur_thread->pgdir != NULL && vaddr < KERNEL_OFFSET \
+		&& (*pte_ptr(vaddr) & PAGE_COW)) {
+		if(copy_on_write(vaddr & 0xfffff000)) {
+			return;
+		}
+		printk("page_fault_handler : out of memory\n");
+	} else if(!(stack->err_code & PF_ERR_P) && cur_thread->pgdir != NULL \
+		&& (vma = vma_find(&cur_thread->vma_list, vaddr)) != NULL) {
+		vaddr &= 0xfffff000;
+		// 已换出的页从交换分区读回,共享内存段由shm_fault处理,
+		// 文件映射和共享映射由mmap_fault处理,普通区域映射已清0的页框
+		if(prog_page_swapped(vaddr)) {
+			if(swap_in(vaddr)) {
+				return;
+			}
+		} else if(vma->shm != NULL) {
+			if(shm_fault(vma, vaddr)) {
+				return;
 			}
+		} else if(vma->inode != NULL || (vma->flags & VM_SHARED)) {
+			if(mmap_fault(vma, vaddr)) {
+				return;
+			}
+		} else if(user_page_map(vaddr)) {
+			return;
 		}
-		lock_release(&mem_pool->lock);
+		printk("page_fault_handler : out of memory\n");
 	}
+	printk("page fault addr : %x, eip : %x, err_code : %x, task : %s\n", \
+		vaddr, (uint32_t) stack->eip, stack->err_code, cur_thread->name);
+	PANIC("page fault");
 }
 
 // 内存管理初始化
 void mm_init() {
-	init_kernel_vmm();
-	init_mem_pool(*((uint32_t*) P2V(TOTAL_MEM_SIZE_PADDR)));
+	uint32_t mem_end = detect_memory();
+	boot_alloc_ptr = ((uint32_t) kern_end + PAGE_SIZE - 1) & 0xfffff000;
+	init_kernel_vmm(mem_end);
+	init_mem_pool(mem_end);
 	init_block_desc(kernel_block_descs);
+	lock_init(&kernel_heap_lock);
+	kmem_cache_init();
+	vma_cache_init();
+	mmap_init();
+	shm_init();
+	register_intr_handler(14, page_fault_handler);
 	
+	printk("kernel pool free pages : %d, user pool free pages : %d\n", \
+		kernel_pool.free_pages, user_pool.free_pages);
 	printk("mm_init done\n");
 }
 
@@ -7,48 +7,120 @@
 
 #define MEM_BLOCK_DESC_COUNT 7 // 内存块描述符个数
 
+#define MAX_ORDER 11 // buddy系统的阶数,最大块为2^10个页框(4MB)
+
+// 页框标志
+#define PG_FREE 0x1 // 页框是buddy空闲块的首页框
+#define PG_RESERVED 0x2 // 页框不是可用内存(内存空洞或保留区),不能分配
+#define PG_DIRTY 0x4 // 共享映射的页框被写入过,需要写回文件
+
 // 内存池类型
 enum pool_flag {
 	PF_KERNEL = 1,
 	PF_USER = 2
 };
 
-// 虚拟地址池
-struct vaddr_pool {
-	struct bitmap vaddr_btmp; // 虚拟地址用到的位图结构
-	uint32_t vaddr_start; // 虚拟地址起始地址
+// 物理页框描述符
+struct page {
+	struct list_ele free_ele; // 在buddy空闲链表中的节点
+	uint8_t order; // 所在块的阶(仅块的首页框有效)
+	uint8_t flags; // 页框标志
+	void *slab; // 页框属于slab时指向其管理结构
+	uint32_t ref_count; // 映射此用户页框的页表项数,写时复制时大于1
 };
 
 // 内存块
 struct mem_block {
-	struct list_ele free_ele;
+	struct mem_block *next; // 同一arena内的下一个空闲内存块
 };
 
 // 内存块描述符
 struct mem_block_desc {
 	uint32_t block_size; // 内存块大小
 	uint32_t block_count; // arena可容纳的mem_block的数量
-	struct list free_list; // 可用的mem_block链表
+	struct list partial_list; // 还有空闲mem_block的arena链表
+};
+
+#define MAGAZINE_SIZE 6 // 每个magazine最多缓存的对象数
+#define MAGAZINE_BATCH 3 // magazine空或满时与全局内存池一次交换的对象数
+
+// 任务私有的空闲对象缓存,分配和释放先在这里进行,
+// 只有空或满时才加锁批量访问全局的内存池或内核堆
+struct magazine {
+	uint32_t count; // 缓存的对象数
+	void *objs[MAGAZINE_SIZE]; // 页框的物理地址或内存块的地址
+};
+
+// 任务的所有magazine
+struct task_magazines {
+	struct magazine frames[2]; // 内核,用户内存池的单个页框
+	struct magazine blocks[MEM_BLOCK_DESC_COUNT]; // 内核堆各规格的内存块
 };
 
+// 临时映射区中各用途使用的页
+enum kmap_slot {
+	KMAP_COW, // 写时复制时的新页框
+	KMAP_ZERO, // 清0不在直接映射区的页框
+	KMAP_SWAP, // 换出换入的页框
+	KMAP_MMAP // 读入私有文件映射的页框
+};
+
+struct task_struct;
+
 void mm_init();
 
+void *kmap(uint32_t paddr, enum kmap_slot slot);
+
 void init_block_desc(struct mem_block_desc *desc_arr);
 
 uint32_t kern_v2p(uint32_t vaddr);
 
+struct page *paddr2page(uint32_t paddr);
+
+struct page *kvaddr2page(void *vaddr);
+
+void put_user_page(uint32_t paddr);
+
 void *kmalloc(uint32_t size, enum pool_flag pf);
 
 void kfree(void *vaddr, uint32_t size);
 
+uint32_t free_page_count(enum pool_flag pf);
+
 void *get_kernel_pages(uint32_t size);
 
+void *get_zeroed_kernel_page(void);
+
+void *get_user_frame(bool zeroed);
+
+bool refill_zeroed_page(void);
+
+void magazines_drain(struct task_magazines *mags);
+
 void *get_prog_pages(uint32_t vaddr, uint32_t size);
 
-void *get_page_without_btmp(uint32_t vaddr);
+bool prog_page_present(uint32_t vaddr);
+
+bool prog_page_map(uint32_t vaddr, uint32_t paddr, uint32_t flags);
+
+bool copy_prog_pages(uint32_t *child_pgdir);
+
+void release_prog_space(struct task_struct *pthread);
+
+void *kernel_malloc(uint32_t size);
+
+void kernel_free(void *ptr);
+
+void *user_malloc(uint32_t size);
+
+void user_free(void *ptr);
 
 void *sys_malloc(uint32_t size);
 
 void sys_free(void *ptr);
 
+uint32_t sys_brk(uint32_t new_brk);
+
+void *sys_sbrk(int32_t increment);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "mmap.h"
+#include "types.h"
+#include "global.h"
+#include "list.h"
+#include "debug.h"
+#include "print.h"
+#include "string.h"
+#include "memory.h"
+#include "thread.h"
+#include "sync.h"
+#include "interrupt.h"
+#include "slab.h"
+#include "ide.h"
+#include "bcache.h"
+#include "inode.h"
+#include "fs.h"
+#include "file.h"
+
+// 默认情况下操作的分区
+extern struct partition *cur_part;
+
+// 文件表,定义在file.c
+extern struct file file_table[MAX_FILE_OPEN];
+
+#define BLOCKS_PER_PAGE (PAGE_SIZE / BLOCK_SIZE) // 每页的块数
+#define FILE_MAX_BLOCKS 140 // 文件最多的块数,12个直接块 + 128个间接块
+
+// 共享映射的文件页,同一文件的同一页在所有进程中都映射到这一个页框
+// 链表持有页框的一次引用和inode的一次打开,页框不再被任何进程映射时由mmap_trim写回并释放
+struct shared_page {
+	struct inode *inode; // 所属文件
+	uint32_t index; // 页在文件中的序号
+	uint32_t paddr; // 页框物理地址
+	struct list_ele page_tag; // 在shared_pages中的节点
+};
+
+// 所有共享映射的文件页
+static struct list shared_pages;
+
+// 保护shared_pages
+static struct lock shared_pages_lock;
+
+// shared_page的cache
+static struct kmem_cache *shared_page_cache;
+
+// 返回inode第block_index块的扇区地址,空洞时返回0
+// 用到一级间接块时将其读入*indirect,由调用者释放
+static uint32_t file_block_lba(struct inode *inode, uint32_t block_index, uint32_t **indirect) {
+	if(block_index < 12) {
+		return inode->sectors[block_index];
+	}
+	if(inode->sectors[12] == 0) {
+		return 0;
+	}
+	if(*indirect == NULL) {
+		*indirect = (uint32_t*) kernel_malloc(BLOCK_SIZE);
+		if(*indirect == NULL) {
+			return 0;
+		}
+		bcache_read(cur_part->disk, inode->sectors[12], *indirect, 1);
+	}
+	return (*indirect)[block_index - 12];
+}
+
+// 在文件inode的第index页和page之间读写,write为false时读入
+// 经缓冲区缓存读写,与read/write看到的内容一致
+// 地址连续的扇区合并为一次操作,文件尾之后的部分读入时清0,写入时跳过
+static void file_page_io(struct inode *inode, uint32_t index, void *page, bool write) {
+	uint32_t *indirect = NULL;
+	uint32_t block_start = index * BLOCKS_PER_PAGE;
+	uint32_t block_end = DIV_ROUND_UP(inode->i_size, BLOCK_SIZE);
+	if(block_end > block_start + BLOCKS_PER_PAGE) {
+		block_end = block_start + BLOCKS_PER_PAGE;
+	}
+	if(block_end > FILE_MAX_BLOCKS) {
+		block_end = FILE_MAX_BLOCKS;
+	}
+	if(!write) {
+		memset(page, 0, PAGE_SIZE);
+	}
+	uint32_t block_index = block_start;
+	while(block_index < block_end) {
+		uint32_t lba = file_block_lba(inode, block_index, &indirect);
+		if(lba == 0) {
+			++block_index;
+			continue;
+		}
+		uint32_t count = 1;
+		while(block_index + count < block_end \
+			&& file_block_lba(inode, block_index + count, &indirect) == lba + count) {
+			++count;
+		}
+		void *buf = (uint8_t*) page + (block_index - block_start) * BLOCK_SIZE;
+		if(write) {
+			bcache_write(cur_part->disk, lba, buf, count);
+		} else {
+			bcache_read(cur_part->disk, lba, buf, count);
+		}
+		block_index += count;
+	}
+	// 最后一块中文件尾之后的内容不属于文件
+	uint32_t page_end = (index + 1) * PAGE_SIZE;
+	if(!write && inode->i_size > index * PAGE_SIZE && inode->i_size < page_end) {
+		memset((uint8_t*) page + inode->i_size % PAGE_SIZE, 0, page_end - inode->i_size);
+	}
+	if(indirect != NULL) {
+		kernel_free(indirect);
+	}
+}
+
+// 在shared_pages中查找文件inode的第index页,调用者持有shared_pages_lock
+static struct shared_page *shared_page_find(struct inode *inode, uint32_t index) {
+	struct list_ele *ele = shared_pages.head.next;
+	while(ele != &shared_pages.tail) {
+		struct shared_page *sp = ELE2ENTRY(struct shared_page, page_tag, ele);
+		if(sp->inode == inode && sp->index == index) {
+			return sp;
+		}
+		ele = ele->next;
+	}
+	return NULL;
+}
+
+// 读入文件inode的第index页并加入shared_pages,失败返回NULL
+// 调用者持有shared_pages_lock
+static struct shared_page *shared_page_load(struct inode *inode, uint32_t index) {
+	struct shared_page *sp = kmem_cache_alloc(shared_page_cache);
+	if(sp == NULL) {
+		return NULL;
+	}
+	// 共享文件页由内核持有,写回和释放时要通过直接映射访问,故从内核内存池分配
+	// 它们受shared_pages缓存的规模约束,进程解除映射后由mmap_trim及时归还
+	void *page = get_kernel_pages(1);
+	if(page == NULL) {
+		kmem_cache_free(shared_page_cache, sp);
+		return NULL;
+	}
+	file_page_io(inode, index, page, false);
+	sp->inode = inode;
+	sp->index = index;
+	sp->paddr = V2P((uint32_t) page);
+	// shared_pages持有的引用
+	kvaddr2page(page)->ref_count = 1;
+	++inode->open_count;
+	list_append(&shared_pages, &sp->page_tag);
+	return sp;
+}
+
+// 把文件inode的第index页读入新的用户页框,返回其物理地址,失败返回0
+// 用户页框可能不在直接映射区,先读入内核缓冲页,再关中断通过临时映射区复制
+static uint32_t file_page_read_frame(struct inode *inode, uint32_t index) {
+	void *buf = get_kernel_pages(1);
+	if(buf == NULL) {
+		return 0;
+	}
+	file_page_io(inode, index, buf, false);
+	uint32_t paddr = (uint32_t) get_user_frame(false);
+	if(paddr != 0) {
+		enum intr_status old_status = get_intr_status();
+		disable_intr();
+		memcpy(kmap(paddr, KMAP_MMAP), buf, PAGE_SIZE);
+		set_intr_status(old_status);
+	}
+	kfree(buf, 1);
+	return paddr;
+}
+
+// 处理映射区域vma中未映射的页vaddr
+// 共享文件映射映射shared_pages中的页框,私有文件映射读入新页框,共享匿名映射映射已清0的页框
+bool mmap_fault(struct vm_area *vma, uint32_t vaddr) {
+	ASSERT(!(vaddr & 0xfff) && vaddr >= vma->start && vaddr < vma->end);
+	uint32_t index = (vaddr - vma->start + vma->offset) / PAGE_SIZE;
+	if(vma->inode != NULL && (vma->flags & VM_SHARED)) {
+		lock_acquire(&shared_pages_lock);
+		struct shared_page *sp = shared_page_find(vma->inode, index);
+		if(sp == NULL) {
+			sp = shared_page_load(vma->inode, index);
+		}
+		bool mapped = (sp != NULL && prog_page_map(vaddr, sp->paddr, PAGE_SHARED));
+		if(mapped) {
+			++paddr2page(sp->paddr)->ref_count;
+		}
+		lock_release(&shared_pages_lock);
+		return mapped;
+	}
+	// 私有文件页和匿名页属于进程,从用户内存池分配,内存不足时可以换出其他页
+	uint32_t paddr;
+	if(vma->inode != NULL) {
+		paddr = file_page_read_frame(vma->inode, index);
+	} else {
+		paddr = (uint32_t) get_user_frame(true);
+	}
+	if(paddr == 0) {
+		return false;
+	}
+	paddr2page(paddr)->ref_count = 1;
+	uint32_t flags = (vma->flags & VM_SHARED) ? PAGE_SHARED : 0;
+	if(!prog_page_map(vaddr, paddr, flags)) {
+		put_user_page(paddr);
+		return false;
+	}
+	return true;
+}
+
+// 写回并释放已没有进程映射的共享文件页
+void mmap_trim(void) {
+	lock_acquire(&shared_pages_lock);
+	struct list_ele *ele = shared_pages.head.next;
+	while(ele != &shared_pages.tail) {
+		struct shared_page *sp = ELE2ENTRY(struct shared_page, page_tag, ele);
+		ele = ele->next;
+		struct page *page = paddr2page(sp->paddr);
+		if(page->ref_count > 1) {
+			continue;
+		}
+		if(page->flags & PG_DIRTY) {
+			file_page_io(sp->inode, sp->index, (void*) P2V(sp->paddr), true);
+		}
+		list_remove(&sp->page_tag);
+		put_user_page(sp->paddr);
+		inode_close(sp->inode);
+		kmem_cache_free(shared_page_cache, sp);
+	}
+	lock_release(&shared_pages_lock);
+}
+
+// 在当前进程的用户空间中建立映射,返回映射的起始地址,失败返回MAP_FAILED
+// 只预留地址,页在首次访问时由page_fault_handler调用mmap_fault映射
+void *sys_mmap(const struct mmap_args *args) {
+	struct task_struct *cur_thread = current_thread();
+	uint32_t share = args->flags & (MAP_SHARED | MAP_PRIVATE);
+	if(cur_thread->pgdir == NULL || args->length == 0 || args->length > KERNEL_OFFSET \
+		|| (share != MAP_SHARED && share != MAP_PRIVATE)) {
+		printk("sys_mmap : invalid argument\n");
+		return MAP_FAILED;
+	}
+	uint32_t size = (args->length + PAGE_SIZE - 1) & 0xfffff000;
+	uint32_t vm_flags = (share == MAP_SHARED ? VM_SHARED : 0);
+	struct inode *inode = NULL;
+	uint32_t offset = 0;
+	if(args->flags & MAP_ANONYMOUS) {
+		if(vm_flags == 0) {
+			// 私有匿名映射就是普通的匿名区域
+			uint32_t start = vma_alloc(&cur_thread->vma_list, size);
+			return start != 0 ? (void*) start : MAP_FAILED;
+		}
+	} else {
+		int32_t fd = args->fd;
+		if(fd <= STDERR_FD || fd >= PROC_MAX_FILE_OPEN || cur_thread->fd_table[fd] == -1 \
+			|| (args->offset & 0xfff)) {
+			printk("sys_mmap : invalid fd or offset\n");
+			return MAP_FAILED;
+		}
+		struct file *file = &file_table[cur_thread->fd_table[fd]];
+		// 共享映射的写入会写回文件,文件需以可写方式打开
+		if(vm_flags != 0 && !(file->fd_flag & FO_WRITEONLY) && !(file->fd_flag & FO_READWRITE)) {
+			printk("sys_mmap : MAP_SHARED needs a writable file\n");
+			return MAP_FAILED;
+		}
+		inode = file->fd_inode;
+		offset = args->offset;
+		// 映射区域持有inode的一次打开,关闭fd后映射仍有效
+		++inode->open_count;
+	}
+	uint32_t start = vma_map(&cur_thread->vma_list, size, vm_flags, inode, offset);
+	if(start == 0) {
+		if(inode != NULL) {
+			inode_close(inode);
+		}
+		return MAP_FAILED;
+	}
+	return (void*) start;
+}
+
+// 解除当前进程[addr, addr + length)的映射,共享文件页在最后一个映射解除时写回文件
+// 成功返回0,失败返回-1
+int32_t sys_munmap(void *addr, uint32_t length) {
+	uint32_t start = (uint32_t) addr;
+	if(current_thread()->pgdir == NULL || (start & 0xfff) || length == 0 \
+		|| start < USER_VADDR_START || length > KERNEL_OFFSET - start) {
+		printk("sys_munmap : invalid argument\n");
+		return -1;
+	}
+	kfree(addr, DIV_ROUND_UP(length, PAGE_SIZE));
+	mmap_trim();
+	return 0;
+}
+
+// 初始化mmap
+void mmap_init(void) {
+	list_init(&shared_pages);
+	lock_init(&shared_pages_lock);
+	shared_page_cache = kmem_cache_create("shared_page", sizeof(struct shared_page), 0, NULL);
+	ASSERT(shared_page_cache != NULL);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,34 @@
+#ifndef __MMAP_H
+#define __MMAP_H
+
+#include "types.h"
+#include "vma.h"
+
+// mmap的标志
+#define MAP_SHARED 0x1 // 共享映射,写入对其他映射者可见并写回文件
+#define MAP_PRIVATE 0x2 // 私有映射,写入只对本进程可见
+#define MAP_ANONYMOUS 0x20 // 匿名映射,不映射文件,页初始为0
+
+// mmap失败时的返回值
+#define MAP_FAILED ((void*) -1)
+
+// mmap的参数,系统调用最多传3个参数,故通过结构体传递
+struct mmap_args {
+	void *addr; // 期望的起始地址,目前忽略
+	uint32_t length; // 映射的字节数
+	uint32_t flags; // MAP_SHARED或MAP_PRIVATE,可加MAP_ANONYMOUS
+	int32_t fd; // 映射的文件,匿名映射时忽略
+	uint32_t offset; // 文件偏移量,按页对齐
+};
+
+void mmap_init(void);
+
+bool mmap_fault(struct vm_area *vma, uint32_t vaddr);
+
+void mmap_trim(void);
+
+void *sys_mmap(const struct mmap_args *args);
+
+int32_t sys_munmap(void *addr, uint32_t length);
+
+#endif
\ No newline at end of file
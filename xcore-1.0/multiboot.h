@@ -3,6 +3,13 @@
 
 #include "types.h"
 
+// struct multiboot中flags的各位
+#define MBOOT_FLAG_MEM (1 << 0) // mem_lower和mem_upper有效
+#define MBOOT_FLAG_MMAP (1 << 6) // mmap_addr和mmap_length有效
+
+// struct mmap_entry中type的取值
+#define MMAP_TYPE_RAM 1 // 可用的内存
+
 struct multiboot {
     uint32_t flags;
     uint32_t mem_lower;
@@ -33,7 +40,7 @@ struct multiboot {
 struct mmap_entry {
 	uint32_t size;
 	uint32_t base_addr_low;
-	uint32_t bae_addr_high;
+	uint32_t base_addr_high;
 	uint32_t length_low;
 	uint32_t length_high;
 	uint32_t type;
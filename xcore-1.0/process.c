@@ -6,12 +6,16 @@
 #include "string.h"
 #include "descriptor.h"
 #include "interrupt.h"
+#include "slab.h"
+#include "vma.h"
 
 extern struct list thread_ready_list; // 就绪队列
 extern struct list thread_all_list; // 所有任务队列
 
 extern uint32_t pgd_kern[PAGE_PGD_SIZE]; // 内核页目录表
 
+extern struct kmem_cache *task_cache; // 定义在thread.c
+
 extern void intr_exit(void); // 定义在idtasm.S源文件
 
 // 构建用户进程初始上下文信息
@@ -35,7 +39,8 @@ void start_process(void *filename) {
 	proc_stack->eip = filename;
 	proc_stack->cs = SELECTOR_USER_CODE;
 	proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
-	proc_stack->esp = (void*) ((uint32_t) get_prog_pages(USER_STACK3_VADDR, 1) + PAGE_SIZE);
+	// 用户栈已在vma_list中预留,物理页在首次访问时分配
+	proc_stack->esp = (void*) (USER_STACK3_VADDR + PAGE_SIZE);
 	proc_stack->ss = SELECTOR_USER_DATA;
 	__asm__ __volatile__(" \
 		movl %0, %%esp; \
@@ -44,16 +49,51 @@ void start_process(void *filename) {
 	);
 }
 
+// 当前cr3中页目录的物理地址,0表示未知
+static uint32_t active_pgdir;
+
+// 为true时每次都重新加载cr3,用于对比测试
+bool pgdir_reload_always = false;
+
+// cr3的加载次数
+uint32_t cr3_load_count;
+
 // 激活页表
+// 所有页目录的内核部分都相同,内核线程又不访问用户空间,
+// 故切换到内核线程时沿用当前的页目录(lazy TLB),页目录相同时也不重新加载cr3
+// 释放进程页目录前,若它仍是active_pgdir,必须先切换到pgd_kern
 void pgdir_activate(struct task_struct *pthread) {
 	ASSERT(pthread != NULL);
-	// 执行此函数时,当前任务可能是线程,
-	// 如果不重新安装页表的话,线程就会使用上一个进程的页表了
+	if(pthread->pgdir == NULL && active_pgdir != 0 && !pgdir_reload_always) {
+		return;
+	}
 	uint32_t pgdir = V2P((uint32_t) pgd_kern);
 	if(pthread->pgdir != NULL) {
 		pgdir = kern_v2p((uint32_t) pthread->pgdir);
 	}
-	__asm__ __volatile__("mov %0, %%cr3" : : "r"(pgdir));
+	if(pgdir == active_pgdir && !pgdir_reload_always) {
+		return;
+	}
+	active_pgdir = pgdir;
+	++cr3_load_count;
+	__asm__ __volatile__("mov %0, %%cr3" : : "r"(pgdir) : "memory");
+}
+
+// 释放进程pthread的页目录,之后pthread被当作内核线程
+// 页目录仍在cr3中时先切换到内核页目录
+void pgdir_release(struct task_struct *pthread) {
+	uint32_t *pgdir = pthread->pgdir;
+	ASSERT(pgdir != NULL);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	pthread->pgdir = NULL;
+	if(active_pgdir == kern_v2p((uint32_t) pgdir)) {
+		active_pgdir = V2P((uint32_t) pgd_kern);
+		++cr3_load_count;
+		__asm__ __volatile__("mov %0, %%cr3" : : "r"(active_pgdir) : "memory");
+	}
+	set_intr_status(old_status);
+	kfree(pgdir, 1);
 }
 
 // 激活线程或进程的页表,更新TSS中的esp0为进程的特权级0的栈
@@ -73,13 +113,14 @@ void process_activate(struct task_struct *pthread) {
 // 创建页目录表,复制内核空间的页表
 uint32_t *create_pgdir(void) {
 	// 用户进程的页表不能让用户直接访问到,故在内核空间申请
-	uint32_t *pgdir_vaddr = get_kernel_pages(1);
+	// 用户空间的页目录项按需创建,故申请已清0的页
+	uint32_t *pgdir_vaddr = get_zeroed_kernel_page();
 	if(pgdir_vaddr == NULL) {
-		console_printk("create_pgdir : get_kernel_pages failed!\n");
+		console_printk("create_pgdir : get_zeroed_kernel_page failed!\n");
 		return NULL;
 	}
-	// 复制页表
 	uint32_t pgd_index = GET_PGD_INDEX(KERNEL_OFFSET);
+	// 复制页表
 	memcpy((uint32_t*) &pgdir_vaddr[pgd_index], \
 		(uint32_t*) &pgd_kern[pgd_index], 1024);
 	// 最后一个页目录项的内容是页目录物理地址
@@ -88,23 +129,26 @@ uint32_t *create_pgdir(void) {
 	return pgdir_vaddr;
 }
 
-// 创建用户进程虚拟地址位图
-void create_user_vaddr_bitmap(struct task_struct *uprog) {
-	uprog->prog_vaddr.vaddr_start = USER_VADDR_START;
-	uint32_t btmp_len = (KERNEL_OFFSET - USER_VADDR_START) / (PAGE_SIZE * 8);
-	uprog->prog_vaddr.vaddr_btmp.byte_len = btmp_len;
-	uint32_t btmp_pg_count = DIV_ROUND_UP( \
-		(KERNEL_OFFSET - USER_VADDR_START) / (PAGE_SIZE * 8), PAGE_SIZE);
-	uprog->prog_vaddr.vaddr_btmp.bits = get_kernel_pages(btmp_pg_count);
-	init_bitmap(&uprog->prog_vaddr.vaddr_btmp);
+// 初始化用户进程的虚拟内存区域
+void create_user_vma(struct task_struct *uprog) {
+	list_init(&uprog->vma_list);
+	// 预留用户栈所在的虚拟地址,栈向下增长时由页错误处理函数按需映射
+	if(!vma_reserve(&uprog->vma_list, KERNEL_OFFSET - USER_STACK_SIZE, KERNEL_OFFSET)) {
+		PANIC("create_user_vma : reserve user stack failed");
+	}
+	// 预留用户堆的第一页,存放用户态malloc的状态,之后的堆由brk扩展
+	if(!vma_reserve(&uprog->vma_list, USER_HEAP_VADDR, USER_HEAP_VADDR + PAGE_SIZE)) {
+		PANIC("create_user_vma : reserve user heap failed");
+	}
+	uprog->brk = USER_HEAP_VADDR + PAGE_SIZE;
 }
 
 // 创建用户进程
 void process_execute(void *filename, char *name) {
 	// PCB由内核来维护,故在内核空间申请
-	struct task_struct *thread = get_kernel_pages(1);
+	struct task_struct *thread = kmem_cache_alloc(task_cache);
 	init_thread(thread, name, USER_DEFAULT_PRIORITY);
-	create_user_vaddr_bitmap(thread);
+	create_user_vma(thread);
 	thread_create(thread, start_process, filename);
 	thread->pgdir = create_pgdir();
 	init_block_desc(thread->prog_block_descs);
@@ -0,0 +1,225 @@
+#include "shm.h"
+#include "types.h"
+#include "global.h"
+#include "list.h"
+#include "debug.h"
+#include "print.h"
+#include "string.h"
+#include "memory.h"
+#include "thread.h"
+#include "sync.h"
+#include "slab.h"
+#include "vma.h"
+#include "mmap.h"
+
+// 所有共享内存段
+static struct list shm_segments;
+// 保护shm_segments和段的attach_count,frames
+static struct lock shm_lock;
+// shm_segment的cache
+static struct kmem_cache *shm_cache;
+
+// 按名字查找共享内存段,调用者持有shm_lock
+static struct shm_segment *shm_find(const char *name) {
+	struct list_ele *ele = shm_segments.head.next;
+	while(ele != &shm_segments.tail) {
+		struct shm_segment *shm = ELE2ENTRY(struct shm_segment, shm_tag, ele);
+		if(!strcmp(shm->name, name)) {
+			return shm;
+		}
+		ele = ele->next;
+	}
+	return NULL;
+}
+
+// 新建page_count页的共享内存段,页框在首次访问时分配,失败返回NULL
+// 调用者持有shm_lock
+static struct shm_segment *shm_create(const char *name, uint32_t page_count) {
+	struct shm_segment *shm = kmem_cache_alloc(shm_cache);
+	if(shm == NULL) {
+		return NULL;
+	}
+	shm->frames = kernel_malloc(page_count * sizeof(uint32_t));
+	if(shm->frames == NULL) {
+		kmem_cache_free(shm_cache, shm);
+		return NULL;
+	}
+	memset(shm->frames, 0, page_count * sizeof(uint32_t));
+	strcpy(shm->name, name);
+	shm->page_count = page_count;
+	shm->attach_count = 0;
+	list_append(&shm_segments, &shm->shm_tag);
+	return shm;
+}
+
+// 增加段的映射数,fork复制或拆分映射区域时调用
+void shm_get(struct shm_segment *shm) {
+	lock_acquire(&shm_lock);
+	++shm->attach_count;
+	lock_release(&shm_lock);
+}
+
+// 减少段的映射数,最后一个映射解除时删除段并归还段持有的页框引用
+// 仍在页表中的页框由解除映射时归还的引用最终释放
+void shm_put(struct shm_segment *shm) {
+	lock_acquire(&shm_lock);
+	ASSERT(shm->attach_count > 0);
+	if(--shm->attach_count > 0) {
+		lock_release(&shm_lock);
+		return;
+	}
+	list_remove(&shm->shm_tag);
+	lock_release(&shm_lock);
+	for(uint32_t i = 0; i < shm->page_count; i++) {
+		if(shm->frames[i] != 0) {
+			put_user_page(shm->frames[i]);
+		}
+	}
+	kernel_free(shm->frames);
+	kmem_cache_free(shm_cache, shm);
+}
+
+// 处理共享内存区域vma中未映射的页vaddr,映射段中对应的页框,首次访问时分配已清0的用户页框
+bool shm_fault(struct vm_area *vma, uint32_t vaddr) {
+	struct shm_segment *shm = vma->shm;
+	ASSERT(shm != NULL && !(vaddr & 0xfff) && vaddr >= vma->start && vaddr < vma->end);
+	uint32_t index = (vaddr - vma->start + vma->offset) / PAGE_SIZE;
+	ASSERT(index < shm->page_count);
+	lock_acquire(&shm_lock);
+	if(shm->frames[index] == 0) {
+		// 段的页框只通过进程的页表访问,从用户内存池分配
+		uint32_t paddr = (uint32_t) get_user_frame(true);
+		if(paddr == 0) {
+			lock_release(&shm_lock);
+			return false;
+		}
+		// 段持有的引用
+		paddr2page(paddr)->ref_count = 1;
+		shm->frames[index] = paddr;
+	}
+	bool mapped = prog_page_map(vaddr, shm->frames[index], PAGE_SHARED);
+	if(mapped) {
+		++paddr2page(shm->frames[index])->ref_count;
+	}
+	lock_release(&shm_lock);
+	return mapped;
+}
+
+// 将名为name的共享内存段映射到当前进程的用户空间,返回起始地址,失败返回MAP_FAILED
+// 段不存在时新建size字节的段;已存在时size为0或不超过段的大小
+void *sys_shmat(const char *name, uint32_t size) {
+	struct task_struct *cur_thread = current_thread();
+	uint32_t name_len = strlen(name);
+	if(cur_thread->pgdir == NULL || name_len == 0 || name_len >= SHM_NAME_LEN \
+		|| size > SHM_MAX_PAGES * PAGE_SIZE) {
+		printk("sys_shmat : invalid argument\n");
+		return MAP_FAILED;
+	}
+	lock_acquire(&shm_lock);
+	struct shm_segment *shm = shm_find(name);
+	if(shm == NULL) {
+		shm = (size == 0 ? NULL : shm_create(name, DIV_ROUND_UP(size, PAGE_SIZE)));
+	} else if(size > shm->page_count * PAGE_SIZE) {
+		shm = NULL;
+	}
+	if(shm == NULL) {
+		lock_release(&shm_lock);
+		printk("sys_shmat : can not attach %s\n", name);
+		return MAP_FAILED;
+	}
+	// 映射区域持有的引用
+	++shm->attach_count;
+	lock_release(&shm_lock);
+	uint32_t start = vma_map(&cur_thread->vma_list, shm->page_count * PAGE_SIZE, \
+		VM_SHARED, NULL, 0);
+	if(start == 0) {
+		shm_put(shm);
+		return MAP_FAILED;
+	}
+	vma_find(&cur_thread->vma_list, start)->shm = shm;
+	return (void*) start;
+}
+
+// 解除当前进程从addr开始的共享内存段映射,成功返回0,失败返回-1
+int32_t sys_shmdt(const void *addr) {
+	struct task_struct *cur_thread = current_thread();
+	uint32_t start = (uint32_t) addr;
+	struct vm_area *vma = NULL;
+	if(cur_thread->pgdir != NULL && start < KERNEL_OFFSET) {
+		vma = vma_find(&cur_thread->vma_list, start);
+	}
+	if(vma == NULL || vma->shm == NULL || vma->start != start) {
+		printk("sys_shmdt : %x is not attached\n", start);
+		return -1;
+	}
+	kfree((void*) start, (vma->end - vma->start) / PAGE_SIZE);
+	return 0;
+}
+
+// 初始化共享内存
+void shm_init(void) {
+	list_init(&shm_segments);
+	lock_init(&shm_lock);
+	shm_cache = kmem_cache_create("shm_segment", sizeof(struct shm_segment), 0, NULL);
+	ASSERT(shm_cache != NULL);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
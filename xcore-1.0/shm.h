@@ -0,0 +1,34 @@
+#ifndef __SHM_H
+#define __SHM_H
+
+#include "types.h"
+#include "list.h"
+
+#define SHM_NAME_LEN 16 // 共享内存段名的最大长度(含结尾的0)
+#define SHM_MAX_PAGES 1024 // 共享内存段的最大页数
+
+struct vm_area;
+
+// 按名字共享的内存段,映射到各进程时都使用同一组页框
+// 段持有每个页框的一次引用,最后一个映射它的vm_area释放时回收段和页框
+struct shm_segment {
+	char name[SHM_NAME_LEN]; // 段名
+	uint32_t page_count; // 段的页数
+	uint32_t *frames; // 各页的页框物理地址,0表示尚未访问过
+	uint32_t attach_count; // 映射此段的vm_area数
+	struct list_ele shm_tag; // 在shm_segments中的节点
+};
+
+void shm_init(void);
+
+void shm_get(struct shm_segment *shm);
+
+void shm_put(struct shm_segment *shm);
+
+bool shm_fault(struct vm_area *vma, uint32_t vaddr);
+
+void *sys_shmat(const char *name, uint32_t size);
+
+int32_t sys_shmdt(const void *addr);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include "slab.h"
+#include "types.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "debug.h"
+#include "print.h"
+
+#define CACHE_LINE_SIZE 32 // 着色偏移的最小单位
+#define SLAB_OFF_SLAB_SIZE (PAGE_SIZE / 8) // 对象不小于此值时管理结构放在slab之外
+#define SLAB_MAX_PAGES 4 // 每个slab最多占用的页数
+#define SLAB_MIN_OBJS 8 // 每个slab至少容纳的对象数(页数允许时)
+#define SLAB_MAX_OFF_OBJS (SLAB_MAX_PAGES * PAGE_SIZE / SLAB_OFF_SLAB_SIZE)
+#define SLAB_FREE_LIMIT 1 // 每个cache最多保留的空闲slab数
+#define BUFCTL_END 0xffff // 空闲对象链表结束标志
+
+// slab管理结构
+struct slab {
+	struct kmem_cache *cache; // 所属的cache
+	struct list_ele slab_tag; // 在cache的slab链表中的节点
+	void *pages; // slab所占页的起始地址
+	uint8_t *objs; // 第一个对象的地址(已加上着色偏移)
+	uint32_t inuse; // 已分配的对象数
+	uint16_t free; // 第一个空闲对象的下标
+	// 空闲对象链表,bufctl[i]是对象i之后的下一个空闲对象,
+	// 链表不存放在对象内,以保留构造函数初始化的状态
+	uint16_t bufctl[];
+};
+
+// 管理kmem_cache结构本身的cache
+static struct kmem_cache cache_cache;
+
+// off_slab时存放slab管理结构的cache
+static struct kmem_cache slab_mgmt_cache;
+
+// 计算cache中每个slab的页数,对象数及着色
+static void cache_estimate(struct kmem_cache *cache) {
+	uint32_t slab_pages = 1;
+	uint32_t obj_count;
+	uint32_t mgmt_size;
+	while(true) {
+		uint32_t total = slab_pages * PAGE_SIZE;
+		if(cache->off_slab) {
+			mgmt_size = 0;
+			obj_count = total / cache->obj_size;
+		} else {
+			// 管理结构和bufctl放在slab头部,其后的对象按align对齐
+			obj_count = (total - sizeof(struct slab)) / (cache->obj_size + sizeof(uint16_t));
+			mgmt_size = sizeof(struct slab) + obj_count * sizeof(uint16_t);
+			mgmt_size = (mgmt_size + cache->align - 1) & ~(cache->align - 1);
+			while(mgmt_size + obj_count * cache->obj_size > total) {
+				--obj_count;
+				mgmt_size = sizeof(struct slab) + obj_count * sizeof(uint16_t);
+				mgmt_size = (mgmt_size + cache->align - 1) & ~(cache->align - 1);
+			}
+		}
+		if(obj_count >= SLAB_MIN_OBJS || slab_pages == SLAB_MAX_PAGES) {
+			break;
+		}
+		slab_pages *= 2;
+	}
+	ASSERT(obj_count > 0 && obj_count < BUFCTL_END);
+	cache->slab_pages = slab_pages;
+	cache->obj_count = obj_count;
+	cache->mgmt_size = mgmt_size;
+	// 剩余的空间用于着色,使不同slab中同一下标的对象错开cache行
+	uint32_t left_over = slab_pages * PAGE_SIZE - mgmt_size - obj_count * cache->obj_size;
+	cache->color_off = cache->align > CACHE_LINE_SIZE ? cache->align : CACHE_LINE_SIZE;
+	cache->color_count = left_over / cache->color_off + 1;
+	cache->color_next = 0;
+}
+
+// 初始化cache的各字段
+static void cache_setup(struct kmem_cache *cache, char *name, uint32_t size, \
+	uint32_t align, kmem_ctor *ctor) {
+	ASSERT(strlen(name) < 16);
+	memset(cache, 0, sizeof(struct kmem_cache));
+	strcpy(cache->name, name);
+	if(align < sizeof(void*)) {
+		align = sizeof(void*);
+	}
+	ASSERT((align & (align - 1)) == 0);
+	cache->align = align;
+	cache->obj_size = (size + align - 1) & ~(align - 1);
+	cache->off_slab = cache->obj_size >= SLAB_OFF_SLAB_SIZE;
+	cache->ctor = ctor;
+	cache_estimate(cache);
+	ASSERT(!cache->off_slab || cache->obj_count <= SLAB_MAX_OFF_OBJS);
+	list_init(&cache->slabs_partial);
+	list_init(&cache->slabs_full);
+	list_init(&cache->slabs_free);
+	cache->free_slab_count = 0;
+	lock_init(&cache->lock);
+}
+
+// 为cache新建一个slab,并放入slabs_free,失败返回NULL
+static struct slab *cache_grow(struct kmem_cache *cache) {
+	void *pages = get_kernel_pages(cache->slab_pages);
+	if(pages == NULL) {
+		return NULL;
+	}
+	struct slab *slab;
+	if(cache->off_slab) {
+		slab = kmem_cache_alloc(&slab_mgmt_cache);
+		if(slab == NULL) {
+			kfree(pages, cache->slab_pages);
+			return NULL;
+		}
+	} else {
+		slab = (struct slab*) pages;
+	}
+	slab->cache = cache;
+	slab->pages = pages;
+	slab->objs = (uint8_t*) pages + cache->mgmt_size + cache->color_next * cache->color_off;
+	slab->inuse = 0;
+	if(++cache->color_next == cache->color_count) {
+		cache->color_next = 0;
+	}
+	// 串起所有空闲对象
+	for(uint32_t i = 0; i < cache->obj_count; i++) {
+		slab->bufctl[i] = i + 1;
+	}
+	slab->bufctl[cache->obj_count - 1] = BUFCTL_END;
+	slab->free = 0;
+	// 记录slab所占的每个页框,释放对象时据此找到slab
+	for(uint32_t i = 0; i < cache->slab_pages; i++) {
+		kvaddr2page((uint8_t*) pages + i * PAGE_SIZE)->slab = slab;
+	}
+	if(cache->ctor != NULL) {
+		for(uint32_t i = 0; i < cache->obj_count; i++) {
+			cache->ctor(slab->objs + i * cache->obj_size);
+		}
+	}
+	list_append(&cache->slabs_free, &slab->slab_tag);
+	++cache->free_slab_count;
+	return slab;
+}
+
+// 销毁空闲的slab,归还其占用的页
+static void slab_destroy(struct kmem_cache *cache, struct slab *slab) {
+	ASSERT(slab->inuse == 0);
+	void *pages = slab->pages;
+	for(uint32_t i = 0; i < cache->slab_pages; i++) {
+		kvaddr2page((uint8_t*) pages + i * PAGE_SIZE)->slab = NULL;
+	}
+	if(cache->off_slab) {
+		kmem_cache_free(&slab_mgmt_cache, slab);
+	}
+	kfree(pages, cache->slab_pages);
+}
+
+// 创建对象大小为size,按align对齐的cache
+// ctor不为NULL时,对象在slab创建时被构造一次,释放回cache的对象应保持构造后的状态
+struct kmem_cache *kmem_cache_create(char *name, uint32_t size, \
+	uint32_t align, kmem_ctor *ctor) {
+	ASSERT(size > 0 && size <= SLAB_MAX_PAGES * PAGE_SIZE);
+	struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+	if(cache == NULL) {
+		printk("kmem_cache_create : alloc cache %s failed!\n", name);
+		return NULL;
+	}
+	cache_setup(cache, name, size, align, ctor);
+	return cache;
+}
+
+// 从cache中分配一个对象,失败返回NULL
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+	lock_acquire(&cache->lock);
+	struct slab *slab;
+	// 优先使用部分分配的slab,其次是空闲slab,都没有时新建slab
+	if(!list_empty(&cache->slabs_partial)) {
+		slab = ELE2ENTRY(struct slab, slab_tag, cache->slabs_partial.head.next);
+	} else {
+		if(list_empty(&cache->slabs_free) && cache_grow(cache) == NULL) {
+			lock_release(&cache->lock);
+			return NULL;
+		}
+		slab = ELE2ENTRY(struct slab, slab_tag, cache->slabs_free.head.next);
+		list_remove(&slab->slab_tag);
+		--cache->free_slab_count;
+		list_append(&cache->slabs_partial, &slab->slab_tag);
+	}
+	ASSERT(slab->free != BUFCTL_END);
+	void *obj = slab->objs + slab->free * cache->obj_size;
+	slab->free = slab->bufctl[slab->free];
+	if(++slab->inuse == cache->obj_count) {
+		list_remove(&slab->slab_tag);
+		list_append(&cache->slabs_full, &slab->slab_tag);
+	}
+	lock_release(&cache->lock);
+	return obj;
+}
+
+// 将对象obj归还给cache
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+	ASSERT(obj != NULL);
+	struct slab *slab = kvaddr2page(obj)->slab;
+	ASSERT(slab != NULL && slab->cache == cache);
+	lock_acquire(&cache->lock);
+	uint32_t offset = (uint8_t*) obj - slab->objs;
+	uint32_t index = offset / cache->obj_size;
+	ASSERT(index < cache->obj_count && offset % cache->obj_size == 0);
+	slab->bufctl[index] = slab->free;
+	slab->free = index;
+	bool was_full = (slab->inuse == cache->obj_count);
+	--slab->inuse;
+	if(slab->inuse == 0) {
+		list_remove(&slab->slab_tag);
+		list_append(&cache->slabs_free, &slab->slab_tag);
+		// 空闲slab过多时将最早的一个归还给内存池
+		if(++cache->free_slab_count > SLAB_FREE_LIMIT) {
+			struct slab *victim = ELE2ENTRY(struct slab, slab_tag, \
+				list_pop(&cache->slabs_free));
+			--cache->free_slab_count;
+			slab_destroy(cache, victim);
+		}
+	} else if(was_full) {
+		list_remove(&slab->slab_tag);
+		list_append(&cache->slabs_partial, &slab->slab_tag);
+	}
+	lock_release(&cache->lock);
+}
+
+// 初始化slab分配器
+void kmem_cache_init(void) {
+	cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, NULL);
+	cache_setup(&slab_mgmt_cache, "slab_mgmt", \
+		sizeof(struct slab) + SLAB_MAX_OFF_OBJS * sizeof(uint16_t), 0, NULL);
+	printk("kmem_cache_init done\n");
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include "types.h"
+#include "list.h"
+#include "sync.h"
+
+// 对象构造函数类型,slab创建时对每个对象调用一次
+typedef void kmem_ctor(void *obj);
+
+// 对象缓存
+struct kmem_cache {
+	char name[16];
+	uint32_t obj_size; // 按align对齐后的对象大小
+	uint32_t align; // 对象对齐字节数
+	uint32_t slab_pages; // 每个slab占用的页数
+	uint32_t obj_count; // 每个slab可容纳的对象数
+	uint32_t mgmt_size; // slab内管理结构占用的字节数,off_slab时为0
+	uint32_t color_off; // 着色偏移的单位
+	uint32_t color_count; // 着色的种数
+	uint32_t color_next; // 下一个新slab使用的着色
+	bool off_slab; // slab管理结构是否放在slab之外
+	kmem_ctor *ctor; // 对象构造函数
+	struct list slabs_partial; // 部分对象已分配的slab
+	struct list slabs_full; // 对象全部已分配的slab
+	struct list slabs_free; // 对象全部空闲的slab
+	uint32_t free_slab_count; // slabs_free中的slab数
+	struct lock lock;
+};
+
+void kmem_cache_init(void);
+
+struct kmem_cache *kmem_cache_create(char *name, uint32_t size, \
+	uint32_t align, kmem_ctor *ctor);
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+#endif
\ No newline at end of file
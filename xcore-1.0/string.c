@@ -1,31 +1,188 @@
 #include "types.h"
 #include "debug.h"
+#include "x86.h"
+#include "interrupt.h"
+
+// 不小于此字节数时才使用SSE2,小块数据用rep指令更快
+#define SSE2_MIN_SIZE 512
+
+// SSE2每次最多处理的字节数,期间关中断,不宜过长
+#define SSE2_CHUNK_SIZE 4096
+
+// 为true时memset和memcpy使用SSE2,由string_init根据CPUID设置
+bool string_sse2_enabled = false;
+
+// 检测CPU是否支持SSE2,支持时开启SSE指令
+// 任务切换时不保存xmm寄存器,编译时也未开启SSE,
+// 只有这里的mem函数在关中断时使用它们,故内联汇编不必声明xmm寄存器被修改
+void string_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if((edx & CPUID_EDX_FXSR) && (edx & CPUID_EDX_SSE2)) {
+		write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+		write_cr4(read_cr4() | CR4_OSFXSR);
+		string_sse2_enabled = true;
+	}
+}
+
+// 处理size个字节时能否使用SSE2
+// SSE2只在关中断时使用,用户进程不能关中断,故只有特权级0才使用
+static inline bool sse2_usable(uint32_t size) {
+	uint32_t cs;
+	__asm__ __volatile__("mov %%cs, %0" : "=r"(cs));
+	return string_sse2_enabled && size >= SSE2_MIN_SIZE && !(cs & 3);
+}
+
+// 按字节填充count个字节
+static inline void stosb(uint8_t *dst, uint8_t value, uint32_t count) {
+	__asm__ __volatile__("cld; rep stosb" : "+D"(dst), "+c"(count) : "a"(value) : "memory");
+}
+
+// 按字节复制count个字节
+static inline void movsb(uint8_t *dst, const uint8_t *src, uint32_t count) {
+	__asm__ __volatile__("cld; rep movsb" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+// 用SSE2将dst起始的blocks个64字节置为value,dst需16字节对齐
+static void sse2_set(uint8_t *dst, uint8_t value, uint32_t blocks) {
+	uint32_t fill[4];
+	fill[0] = fill[1] = fill[2] = fill[3] = value * 0x01010101;
+	while(blocks > 0) {
+		uint32_t count = blocks < SSE2_CHUNK_SIZE / 64 ? blocks : SSE2_CHUNK_SIZE / 64;
+		blocks -= count;
+		enum intr_status old_status = get_intr_status();
+		disable_intr();
+		__asm__ __volatile__(" \
+			movdqu (%2), %%xmm0; \
+			1: \
+			movdqa %%xmm0, (%0); \
+			movdqa %%xmm0, 16(%0); \
+			movdqa %%xmm0, 32(%0); \
+			movdqa %%xmm0, 48(%0); \
+			add $64, %0; \
+			dec %1; \
+			jnz 1b" \
+			: "+r"(dst), "+r"(count) : "r"(fill) : "memory" \
+		);
+		set_intr_status(old_status);
+	}
+}
+
+// 用SSE2将src起始的blocks个64字节复制到dst,dst需16字节对齐
+// 先读后写,dst在src之前时重叠也能正确复制
+static void sse2_copy(uint8_t *dst, const uint8_t *src, uint32_t blocks) {
+	while(blocks > 0) {
+		uint32_t count = blocks < SSE2_CHUNK_SIZE / 64 ? blocks : SSE2_CHUNK_SIZE / 64;
+		blocks -= count;
+		enum intr_status old_status = get_intr_status();
+		disable_intr();
+		__asm__ __volatile__(" \
+			1: \
+			movdqu (%1), %%xmm0; \
+			movdqu 16(%1), %%xmm1; \
+			movdqu 32(%1), %%xmm2; \
+			movdqu 48(%1), %%xmm3; \
+			movdqa %%xmm0, (%0); \
+			movdqa %%xmm1, 16(%0); \
+			movdqa %%xmm2, 32(%0); \
+			movdqa %%xmm3, 48(%0); \
+			add $64, %0; \
+			add $64, %1; \
+			dec %2; \
+			jnz 1b" \
+			: "+r"(dst), "+r"(src), "+r"(count) : : "memory" \
+		);
+		set_intr_status(old_status);
+	}
+}
 
 // 将dst起始的size个字节置为value
 void memset(void *dst, uint8_t value, uint32_t size) {
-	ASSERT(dst != NULL);
 	uint8_t *_dst = (uint8_t*) dst;
-	while(size-- > 0) {
-		*_dst++ = value;
+	uint32_t align = sse2_usable(size) ? 16 : 4;
+	// 先按字节填充到对齐边界
+	uint32_t head = (align - ((uint32_t) _dst & (align - 1))) & (align - 1);
+	if(head > size) {
+		head = size;
+	}
+	stosb(_dst, value, head);
+	_dst += head;
+	size -= head;
+	if(align == 16) {
+		sse2_set(_dst, value, size / 64);
+		_dst += size & ~63;
+		size &= 63;
+	}
+	uint32_t count = size / 4;
+	__asm__ __volatile__("cld; rep stosl" : "+D"(_dst), "+c"(count) \
+		: "a"(value * 0x01010101) : "memory");
+	stosb(_dst, value, size & 3);
+}
+
+// 从低地址向高地址复制,dst在src之前时重叠也能正确复制
+static void copy_forward(uint8_t *dst, const uint8_t *src, uint32_t size) {
+	uint32_t align = sse2_usable(size) ? 16 : 4;
+	// 先按字节复制到dst对齐
+	uint32_t head = (align - ((uint32_t) dst & (align - 1))) & (align - 1);
+	if(head > size) {
+		head = size;
+	}
+	movsb(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+	if(align == 16) {
+		sse2_copy(dst, src, size / 64);
+		dst += size & ~63;
+		src += size & ~63;
+		size &= 63;
 	}
+	uint32_t count = size / 4;
+	__asm__ __volatile__("cld; rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+	movsb(dst, src, size & 3);
 }
 
-// 将src起始的size个字节复制到dst
+// 将src起始的size个字节复制到dst,两者不能重叠
 void memcpy(void *dst, const void *src, uint32_t size) {
-	ASSERT(dst != NULL && src != NULL);
+	copy_forward((uint8_t*) dst, (const uint8_t*) src, size);
+}
+
+// 将src起始的size个字节复制到dst,两者可以重叠
+void memmove(void *dst, const void *src, uint32_t size) {
 	uint8_t *_dst = (uint8_t*) dst;
 	const uint8_t *_src = (const uint8_t*) src;
-	while(size-- > 0) {
-		*_dst++ = *_src++;
+	if(_dst <= _src || _dst >= _src + size) {
+		copy_forward(_dst, _src, size);
+		return;
 	}
+	// dst与src的尾部重叠,从高地址向低地址复制
+	// 先复制末尾不足4字节的部分,再按4字节复制
+	_dst += size - 1;
+	_src += size - 1;
+	uint32_t count = size & 3;
+	__asm__ __volatile__(" \
+		std; \
+		rep movsb; \
+		sub $3, %%esi; \
+		sub $3, %%edi; \
+		mov %3, %%ecx; \
+		rep movsl; \
+		cld" \
+		: "+D"(_dst), "+S"(_src), "+c"(count) : "r"(size / 4) : "memory" \
+	);
 }
 
 // 连续比较以地址s1和地址s2开头的size个字节
 // s1==s2返回0,s1>s2返回+1,s1<s2返回-1
 int memcmp(const void *s1, const void *s2, uint32_t size) {
-	ASSERT(s1 != NULL || s2 != NULL);
-	const char *_s1 = (const char*) s1;
-	const char *_s2 = (const char*) s2;
+	const uint8_t *_s1 = (const uint8_t*) s1;
+	const uint8_t *_s2 = (const uint8_t*) s2;
+	// 先按4字节跳过相同的部分
+	while(size >= 4 && *(const uint32_t*) _s1 == *(const uint32_t*) _s2) {
+		_s1 += 4;
+		_s2 += 4;
+		size -= 4;
+	}
 	while(size-- > 0) {
 		if(*_s1 != *_s2) {
 			return *_s1 > *_s2 ? 1 : -1;
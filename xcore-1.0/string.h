@@ -3,10 +3,14 @@
 
 #include "types.h"
 
+void string_init(void);
+
 void memset(void *dst, uint8_t value, uint32_t size);
 
 void memcpy(void *dst, const void *src, uint32_t size);
 
+void memmove(void *dst, const void *src, uint32_t size);
+
 int memcmp(const void *s1, const void *s2, uint32_t size);
 
 char * strcpy(char *dst, const char *src);
@@ -0,0 +1,280 @@
+#include "swap.h"
+#include "types.h"
+#include "global.h"
+#include "list.h"
+#include "debug.h"
+#include "print.h"
+#include "string.h"
+#include "memory.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "sync.h"
+#include "bitmap.h"
+#include "ide.h"
+#include "vma.h"
+#include "x86.h"
+
+#define SECTORS_PER_SLOT (PAGE_SIZE / 512) // 每个交换槽占用的扇区数
+
+extern struct list partition_list; // 分区队列,定义在ide.c
+extern struct list thread_all_list; // 所有任务队列,定义在thread.c
+
+// 交换分区,没有交换分区时为NULL
+static struct partition *swap_part;
+
+// 交换槽位图,位为1表示交换槽已使用
+static struct bitmap swap_btmp;
+
+// 各交换槽被页表项引用的次数,fork后父子进程共享已换出的页
+// 每个进程最多有一个页表项引用同一交换槽,引用数不超过进程数,16位足够
+static uint16_t *slot_refs;
+
+// 换出换入时暂存页内容,页框可能不在直接映射区,硬盘读写期间又不能占用临时映射区
+static void *swap_buf;
+
+// 串行化换出和换入,保证换入某个交换槽时它的写出已经完成
+static struct lock swap_lock;
+
+// 时钟算法的指针,指向下一个要检查的进程和其中的用户虚拟地址
+static pid_t clock_pid;
+static uint32_t clock_vaddr;
+
+// 在进程pthread的用户空间中从*vaddr开始查找可换出的页,返回其页表项地址并更新*vaddr,没有时返回NULL
+// 只换出只被一个页表项映射的非共享页;访问位为1的页清除访问位,给第二次机会
+// 页表都在内核内存池中,通过直接映射访问,pthread不必是当前进程
+static uint32_t *clock_scan(struct task_struct *pthread, uint32_t *vaddr) {
+	uint32_t *pgdir = pthread->pgdir;
+	bool active = (kern_v2p((uint32_t) pgdir) == read_cr3());
+	struct list_ele *ele = pthread->vma_list.head.next;
+	while(ele != &pthread->vma_list.tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		ele = ele->next;
+		uint32_t addr = vma->start > *vaddr ? vma->start : *vaddr;
+		while(addr < vma->end) {
+			uint32_t pde = pgdir[GET_PGD_INDEX(addr)];
+			if(!(pde & PAGE_P_1)) {
+				// 跳过整个页表
+				addr = (addr & 0xffc00000) + 0x400000;
+				continue;
+			}
+			uint32_t *pte = (uint32_t*) P2V(pde & 0xfffff000) + GET_PTE_INDEX(addr);
+			if((*pte & PAGE_P_1) && !(*pte & PAGE_SHARED) \
+				&& paddr2page(*pte & 0xfffff000)->ref_count == 1) {
+				if(!(*pte & PAGE_A)) {
+					*vaddr = addr;
+					return pte;
+				}
+				*pte &= ~PAGE_A;
+				if(active) {
+					__asm__ __volatile__("invlpg (%0)" : : "r"(addr) : "memory");
+				}
+			}
+			addr += PAGE_SIZE;
+		}
+	}
+	return NULL;
+}
+
+// 从时钟指针处开始在所有用户进程中查找可换出的页,返回其页表项地址,没有时返回NULL
+// 调用者需关中断
+static uint32_t *clock_find(struct task_struct **owner, uint32_t *vaddr) {
+	ASSERT(get_intr_status() == INTR_OFF);
+	struct list_ele *ele = thread_all_list.head.next;
+	while(ele != &thread_all_list.tail \
+		&& ELE2ENTRY(struct task_struct, all_list_tag, ele)->pid != clock_pid) {
+		ele = ele->next;
+	}
+	uint32_t from = clock_vaddr;
+	if(ele == &thread_all_list.tail) {
+		ele = thread_all_list.head.next;
+		from = 0;
+	}
+	// 第一圈清除的访问位在第二圈时已为0,故最多扫描两圈多一个进程
+	uint32_t steps = list_len(&thread_all_list) * 2 + 1;
+	while(steps-- > 0) {
+		struct task_struct *pthread = ELE2ENTRY(struct task_struct, all_list_tag, ele);
+		if(pthread->pgdir != NULL) {
+			uint32_t *pte = clock_scan(pthread, &from);
+			if(pte != NULL) {
+				*owner = pthread;
+				*vaddr = from;
+				clock_pid = pthread->pid;
+				clock_vaddr = from + PAGE_SIZE;
+				return pte;
+			}
+		}
+		from = 0;
+		ele = ele->next;
+		if(ele == &thread_all_list.tail) {
+			ele = thread_all_list.head.next;
+		}
+	}
+	return NULL;
+}
+
+// 按时钟算法换出最多count个用户页,返回实际释放的页框数
+// 页表项改为记录交换槽号的不存在项,页框内容写入交换分区后释放
+uint32_t swap_out(uint32_t count) {
+	if(swap_part == NULL) {
+		return 0;
+	}
+	uint32_t freed = 0;
+	lock_acquire(&swap_lock);
+	while(freed < count) {
+		enum intr_status old_status = get_intr_status();
+		disable_intr();
+		struct task_struct *owner;
+		uint32_t vaddr;
+		uint32_t *pte = clock_find(&owner, &vaddr);
+		int32_t slot = -1;
+		if(pte != NULL) {
+			slot = alloc_bitmap(&swap_btmp, 1);
+		}
+		if(slot == -1) {
+			set_intr_status(old_status);
+			break;
+		}
+		slot_refs[slot] = 1;
+		uint32_t paddr = *pte & 0xfffff000;
+		*pte = ((uint32_t) slot << 12) | PAGE_SWAP;
+		if(kern_v2p((uint32_t) owner->pgdir) == read_cr3()) {
+			__asm__ __volatile__("invlpg (%0)" : : "r"(vaddr) : "memory");
+		}
+		// 页已解除映射,不会再被修改
+		memcpy(swap_buf, kmap(paddr, KMAP_SWAP), PAGE_SIZE);
+		set_intr_status(old_status);
+		ide_write(swap_part->disk, swap_part->lba_start + slot * SECTORS_PER_SLOT, \
+			swap_buf, SECTORS_PER_SLOT);
+		put_user_page(paddr);
+		++freed;
+	}
+	lock_release(&swap_lock);
+	return freed;
+}
+
+// 将交换槽slot的内容读入页框paddr
+void swap_read(uint32_t slot, uint32_t paddr) {
+	ASSERT(swap_part != NULL && slot_refs[slot] > 0);
+	lock_acquire(&swap_lock);
+	ide_read(swap_part->disk, swap_part->lba_start + slot * SECTORS_PER_SLOT, \
+		swap_buf, SECTORS_PER_SLOT);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	memcpy(kmap(paddr, KMAP_SWAP), swap_buf, PAGE_SIZE);
+	set_intr_status(old_status);
+	lock_release(&swap_lock);
+}
+
+// fork复制已换出的页表项时增加交换槽的引用次数
+void swap_dup(uint32_t slot) {
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	ASSERT(slot_refs[slot] > 0 && slot_refs[slot] < 0xffff);
+	++slot_refs[slot];
+	set_intr_status(old_status);
+}
+
+// 减少交换槽的引用次数,没有页表项再引用时释放
+void swap_free(uint32_t slot) {
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	ASSERT(slot_refs[slot] > 0);
+	if(--slot_refs[slot] == 0) {
+		set_bitmap(&swap_btmp, slot, 0);
+	}
+	set_intr_status(old_status);
+}
+
+// 查找分区类型为PART_TYPE_SWAP的分区
+static bool swap_part_find(struct list_ele *ele, __attribute__((unused)) int arg) {
+	struct partition *part = ELE2ENTRY(struct partition, part_tag, ele);
+	return part->fs_type == PART_TYPE_SWAP;
+}
+
+// 初始化交换,使用第一个交换分区,没有时不换出
+void swap_init(void) {
+	lock_init(&swap_lock);
+	struct list_ele *ele = list_traversal(&partition_list, swap_part_find, 0);
+	if(ele == NULL) {
+		printk("swap_init : no swap partition\n");
+		return;
+	}
+	struct partition *part = ELE2ENTRY(struct partition, part_tag, ele);
+	uint32_t slot_count = part->sector_count / SECTORS_PER_SLOT;
+	swap_btmp.byte_len = DIV_ROUND_UP(slot_count, 8);
+	swap_btmp.bits = kernel_malloc(swap_btmp.byte_len);
+	swap_btmp.summary = kernel_malloc(BITMAP_SUMMARY_SIZE(swap_btmp.byte_len));
+	slot_refs = kernel_malloc(slot_count * sizeof(uint16_t));
+	swap_buf = get_kernel_pages(1);
+	if(swap_btmp.bits == NULL || swap_btmp.summary == NULL || slot_refs == NULL || swap_buf == NULL) {
+		PANIC("swap_init : alloc memory failed!");
+	}
+	init_bitmap(&swap_btmp);
+	// 位图末尾不足一个字节的部分不对应交换槽
+	for(uint32_t i = slot_count; i < swap_btmp.byte_len * 8; i++) {
+		set_bitmap(&swap_btmp, i, 1);
+	}
+	memset(slot_refs, 0, slot_count * sizeof(uint16_t));
+	swap_part = part;
+	printk("swap_init : %s, %d slots\n", part->name, slot_count);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
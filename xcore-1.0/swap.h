@@ -0,0 +1,18 @@
+#ifndef __SWAP_H
+#define __SWAP_H
+
+#include "types.h"
+
+#define SWAP_CLUSTER 16 // 内存不足时一次换出的页数
+
+void swap_init(void);
+
+uint32_t swap_out(uint32_t count);
+
+void swap_read(uint32_t slot, uint32_t paddr);
+
+void swap_dup(uint32_t slot);
+
+void swap_free(uint32_t slot);
+
+#endif
\ No newline at end of file
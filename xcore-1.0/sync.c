@@ -67,6 +67,25 @@ void lock_acquire(struct lock *lock) {
 	}
 }
 
+// 尝试获取锁lock,锁被其他线程持有时不阻塞,直接返回false
+bool lock_try_acquire(struct lock *lock) {
+	if(lock->holder == current_thread()) {
+		++lock->repeat_count;
+		return true;
+	}
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	bool acquired = (lock->semaphore.value == 1);
+	if(acquired) {
+		--lock->semaphore.value;
+		lock->holder = current_thread();
+		ASSERT(lock->repeat_count == 0);
+		lock->repeat_count = 1;
+	}
+	set_intr_status(old_status);
+	return acquired;
+}
+
 // 释放锁lock
 void lock_release(struct lock *lock) {
 	ASSERT(lock->holder == current_thread());
@@ -26,6 +26,8 @@ void sema_up(struct semaphore *sema);
 
 void lock_acquire(struct lock *lock);
 
+bool lock_try_acquire(struct lock *lock);
+
 void lock_release(struct lock *lock);
 
 #endif
\ No newline at end of file
@@ -6,6 +6,10 @@
 #include "memory.h"
 #include "fs.h"
 #include "fork.h"
+#include "directory.h"
+#include "mmap.h"
+#include "wait_exit.h"
+#include "shm.h"
 
 #define SYSCALL_COUNT 32
 
@@ -91,6 +95,14 @@ void syscall_init(void) {
 	syscall_table[SYS_REWINDDIR] = sys_rewinddir;
 	syscall_table[SYS_STAT] = sys_stat;
 	syscall_table[SYS_PS] = sys_ps;
+	syscall_table[SYS_BRK] = sys_brk;
+	syscall_table[SYS_SBRK] = sys_sbrk;
+	syscall_table[SYS_MMAP] = sys_mmap;
+	syscall_table[SYS_MUNMAP] = sys_munmap;
+	syscall_table[SYS_EXIT] = sys_exit;
+	syscall_table[SYS_WAIT] = sys_wait;
+	syscall_table[SYS_SHMAT] = sys_shmat;
+	syscall_table[SYS_SHMDT] = sys_shmdt;
 	
 	printk("syscall_init done\n");
 }
@@ -107,16 +119,6 @@ uint32_t write(int32_t fd, const void *buf, uint32_t count) {
 	return _syscall3(SYS_WRITE, fd, buf, count);
 }
 
-// 申请size字节大小的内存
-void *malloc(uint32_t size) {
-	return (void*) _syscall1(SYS_MALLOC, size);
-}
-
-// 释放ptr指向的内存
-void free(void *ptr) {
-	_syscall1(SYS_FREE, ptr);
-}
-
 // fork
 pid_t fork(void) {
 	return _syscall0(SYS_FORK);
@@ -182,9 +184,10 @@ int32_t rmdir(const char *pathname) {
 	return _syscall1(SYS_RMDIR, pathname);
 }
 
-// 读取目录dir
+// 读取目录dir,返回的目录项在下次调用时被覆盖
 struct dir_entry *readdir(struct directory *dir) {
-	return (struct dir_entry*) _syscall1(SYS_READDIR, dir);
+	static struct dir_entry dir_ent;
+	return (struct dir_entry*) _syscall2(SYS_READDIR, dir, &dir_ent);
 }
 
 // 回归目录指针
@@ -207,6 +210,48 @@ void ps(void) {
 	_syscall0(SYS_PS);
 }
 
+// 将堆末尾设为addr,成功返回0,失败返回-1
+int32_t brk(void *addr) {
+	uint32_t new_brk = _syscall1(SYS_BRK, addr);
+	return new_brk == (uint32_t) addr ? 0 : -1;
+}
+
+// 将堆扩展increment字节,返回扩展前的堆末尾,失败返回(void*)-1
+void *sbrk(int32_t increment) {
+	return (void*) _syscall1(SYS_SBRK, increment);
+}
+
+// 将文件fd从offset开始的length字节映射到用户空间,返回映射的起始地址,失败返回MAP_FAILED
+void *mmap(void *addr, uint32_t length, uint32_t flags, int32_t fd, uint32_t offset) {
+	struct mmap_args args = {addr, length, flags, fd, offset};
+	return (void*) _syscall1(SYS_MMAP, &args);
+}
+
+// 解除[addr, addr + length)的映射
+int32_t munmap(void *addr, uint32_t length) {
+	return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+// 结束当前进程,不会返回
+void exit(int32_t status) {
+	_syscall1(SYS_EXIT, status);
+}
+
+// 等待子进程退出,返回其pid,没有子进程时返回-1
+int32_t wait(int32_t *status) {
+	return _syscall1(SYS_WAIT, status);
+}
+
+// 映射名为name的共享内存段,不存在时新建size字节的段,失败返回MAP_FAILED
+void *shmat(const char *name, uint32_t size) {
+	return (void*) _syscall2(SYS_SHMAT, name, size);
+}
+
+// 解除从addr开始的共享内存段映射
+int32_t shmdt(const void *addr) {
+	return _syscall1(SYS_SHMDT, addr);
+}
+
 
 
 
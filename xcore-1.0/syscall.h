@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "fs.h"
+#include "mmap.h"
 
 enum SYSCALL_NR {
 	SYS_GETPID,
@@ -26,7 +27,15 @@ enum SYSCALL_NR {
 	SYS_READDIR,
 	SYS_REWINDDIR,
 	SYS_STAT,
-	SYS_PS
+	SYS_PS,
+	SYS_BRK,
+	SYS_SBRK,
+	SYS_MMAP,
+	SYS_MUNMAP,
+	SYS_EXIT,
+	SYS_WAIT,
+	SYS_SHMAT,
+	SYS_SHMDT
 };
 
 // ----- user call ----------
@@ -35,10 +44,6 @@ pid_t getpid(void);
 
 uint32_t write(int32_t fd, const void *buf, uint32_t count);
 
-void *malloc(uint32_t size);
-
-void free(void *ptr);
-
 int32_t read(int32_t fd, void *buf, uint32_t count);
 
 void putchar(char ch);
@@ -73,6 +78,24 @@ int32_t chdir(const char *path);
 
 void ps(void);
 
+int32_t brk(void *addr);
+
+void *sbrk(int32_t increment);
+
+void *mmap(void *addr, uint32_t length, uint32_t flags, int32_t fd, uint32_t offset);
+
+int32_t munmap(void *addr, uint32_t length);
+
+pid_t fork(void);
+
+void exit(int32_t status);
+
+int32_t wait(int32_t *status);
+
+void *shmat(const char *name, uint32_t size);
+
+int32_t shmdt(const void *addr);
+
 // ----- kernel call --------
 
 void syscall_init(void);
@@ -1,6 +1,7 @@
 #include "thread.h"
 #include "global.h"
 #include "string.h"
+#include "bitmap.h"
 #include "memory.h"
 #include "debug.h"
 #include "interrupt.h"
@@ -10,6 +11,7 @@
 #include "stdio.h"
 #include "fs.h"
 #include "file.h"
+#include "slab.h"
 
 struct task_struct *main_thread; // 主线程
 struct task_struct *idle_thread; // idle线程
@@ -18,25 +20,51 @@ struct list thread_all_list; // 所有任务队列
 static struct list_ele *thread_tag; // 用于保存队列中的线程节点
 struct lock pid_lock; // pid锁
 
+#define MAX_PID_COUNT 1024 // 可同时存在的任务数
+
+// pid位图,位i对应pid i + 1,任务被回收后pid可再分配
+static uint8_t pid_bits[MAX_PID_COUNT / 8];
+static struct bitmap pid_btmp;
+
 extern void switch_to(struct task_struct *cur_task, struct task_struct *next_task);
 extern void init(void);
 
+extern bool magazines_enabled; // 定义在memory.c
+
+// task_struct的cache,PCB和0级栈共占一页,按页对齐
+struct kmem_cache *task_cache;
+
 // 系统空闲时运行的线程
 static void idle(__attribute__((unused)) void *arg) {
 	while(1) {
 		thread_block(TASK_BLOCKED);
+		// 没有其他任务可运行时,先为内存池补充预清零页框
+		while(list_empty(&thread_ready_list) && refill_zeroed_page()) {
+		}
 		// 执行hlt时必须要保证处在开中断的情况下
-		__asm__ __volatile__("sti; hlt" : : : "memory");
+		if(list_empty(&thread_ready_list)) {
+			__asm__ __volatile__("sti; hlt" : : : "memory");
+		}
 	}
 }
 
 // 分配pid
 static pid_t alloc_pid(void) {
-	static pid_t next_pid = 0;
 	lock_acquire(&pid_lock);
-	++next_pid;
+	int bit_index = alloc_bitmap(&pid_btmp, 1);
+	lock_release(&pid_lock);
+	if(bit_index == -1) {
+		PANIC("alloc_pid : no free pid");
+	}
+	return bit_index + 1;
+}
+
+// 归还pid
+void release_pid(pid_t pid) {
+	ASSERT(pid > 0 && pid <= MAX_PID_COUNT);
+	lock_acquire(&pid_lock);
+	set_bitmap(&pid_btmp, pid - 1, 0);
 	lock_release(&pid_lock);
-	return next_pid;
 }
 
 // 给fork函数使用
@@ -108,7 +136,7 @@ void init_thread(struct task_struct *pthread, char *name, uint8_t priority) {
 struct task_struct *thread_start(char *name, uint8_t priority, \
 	thread_func func, void *func_arg) {
 	// PCB都位于内核空间,包括用户进程的PCB也是在内核空间
-	struct task_struct *thread = get_kernel_pages(1);
+	struct task_struct *thread = kmem_cache_alloc(task_cache);
 	init_thread(thread, name, priority);
 	thread_create(thread, func, func_arg);
 	
@@ -204,6 +232,40 @@ void thread_yield(void) {
 	set_intr_status(old_status);
 }
 
+// 在thread_all_list中查找pid对应的任务,不存在时返回NULL
+struct task_struct *pid2thread(pid_t pid) {
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	struct list_ele *ele = thread_all_list.head.next;
+	struct task_struct *found = NULL;
+	while(ele != &thread_all_list.tail) {
+		struct task_struct *pthread = ELE2ENTRY(struct task_struct, all_list_tag, ele);
+		if(pthread->pid == pid) {
+			found = pthread;
+			break;
+		}
+		ele = ele->next;
+	}
+	set_intr_status(old_status);
+	return found;
+}
+
+// 回收已退出的任务over,将其从所有任务队列中去除并归还PCB和pid
+// over的用户空间和文件已在退出时释放,只剩下PCB,0级栈和magazine中缓存的页框,内存块
+void thread_reap(struct task_struct *over) {
+	ASSERT(over != current_thread() && over != main_thread);
+	enum intr_status old_status = get_intr_status();
+	disable_intr();
+	ASSERT(over->status == TASK_HANGING && over->pgdir == NULL);
+	over->status = TASK_DIED;
+	ASSERT(!list_find(&thread_ready_list, &over->general_tag));
+	list_remove(&over->all_list_tag);
+	set_intr_status(old_status);
+	release_pid(over->pid);
+	magazines_drain(&over->mags);
+	kmem_cache_free(task_cache, over);
+}
+
 // 以填充空格的方式输出buf
 static void print_pad(char *buf, int32_t len, void *ptr, char format) {
 	memset(buf, 0, len);
@@ -277,10 +339,18 @@ void thread_init(void) {
 	list_init(&thread_ready_list);
 	list_init(&thread_all_list);
 	lock_init(&pid_lock);
+	pid_btmp.byte_len = MAX_PID_COUNT / 8;
+	pid_btmp.bits = pid_bits;
+	pid_btmp.summary = NULL;
+	init_bitmap(&pid_btmp);
+	task_cache = kmem_cache_create("task_struct", PAGE_SIZE, PAGE_SIZE, NULL);
+	ASSERT(task_cache != NULL);
 	// 先创建第一个用户进程: init,pid为1
 	process_execute(init, "init");
 	// 将当前main函数创建为线程
 	create_main_thread();
+	// 所有任务都有了PCB,分配释放可以经过当前任务的magazine
+	magazines_enabled = true;
 	idle_thread = thread_start("idle", 10, idle, NULL);
 	printk("thread_init done\n");
 }
\ No newline at end of file
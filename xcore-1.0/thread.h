@@ -75,10 +75,13 @@ struct task_struct {
 	struct list_ele general_tag; // 线程在一般队列中的节点
 	struct list_ele all_list_tag; // 线程在thread_all_list中的节点
 	uint32_t *pgdir; // 进程的页目录虚拟地址,如果是线程则为NULL
-	struct vaddr_pool prog_vaddr; // 用户进程的虚拟地址池
+	struct list vma_list; // 用户进程已预留的虚拟内存区域
+	uint32_t brk; // 用户堆的末尾(不含),堆从USER_HEAP_VADDR开始
 	struct mem_block_desc prog_block_descs[MEM_BLOCK_DESC_COUNT]; // 用户进程内存块描述符
+	struct task_magazines mags; // 任务私有的空闲页框和内核内存块缓存
 	uint32_t cwd_inode_nr; // 进程所在的工作目录的inode编号
 	int16_t parent_pid; // 父进程的pid
+	int32_t exit_status; // 进程退出时的返回值,由父进程通过wait获取
 	uint32_t stack_magic; // 魔数,用于检测栈的溢出
 };
 
@@ -103,6 +106,12 @@ void thread_yield(void);
 
 pid_t fork_pid(void);
 
+void release_pid(pid_t pid);
+
+struct task_struct *pid2thread(pid_t pid);
+
+void thread_reap(struct task_struct *over);
+
 void sys_ps(void);
 
 #endif
\ No newline at end of file
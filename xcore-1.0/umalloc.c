@@ -0,0 +1,176 @@
+#include "types.h"
+#include "global.h"
+#include "syscall.h"
+#include "umalloc.h"
+
+// 用户态内存分配器,运行在用户进程中
+// 空闲链表等状态都保存在用户堆的第一页,只在堆空间不足时才通过sbrk进入内核
+
+#define UMALLOC_CLASS_COUNT 8 // 小内存块的规格数,16,32,...,2048字节
+#define UMALLOC_MIN_SHIFT 4 // 最小规格为2^4字节
+#define UMALLOC_LARGE UMALLOC_CLASS_COUNT // 大内存块的规格编号
+#define UMALLOC_GROW_SIZE 0x10000 // 每次至少扩展堆的字节数
+
+// 内存块头部,8字节,使返回的地址按8字节对齐
+struct umalloc_header {
+	uint32_t size; // 内存块大小,包含头部
+	uint32_t class; // 规格编号,大内存块为UMALLOC_LARGE
+};
+
+// 空闲内存块,next与返回给用户的地址重叠
+struct umalloc_block {
+	struct umalloc_header header;
+	struct umalloc_block *next;
+};
+
+// 分配器状态,位于USER_HEAP_VADDR,首次访问时由页错误处理函数映射为全0
+// 全0即为空的分配器,故不需要初始化
+struct umalloc_state {
+	struct umalloc_block *free_list[UMALLOC_CLASS_COUNT]; // 各规格的空闲块
+	struct umalloc_block *large_list; // 释放的大内存块
+	uint32_t top; // 堆中尚未切分的区域的起始地址
+	uint32_t end; // 尚未切分的区域的末尾,即当前的brk
+};
+
+#define UMALLOC_STATE ((struct umalloc_state*) USER_HEAP_VADDR)
+
+// 从堆中尚未切分的区域切出size字节,不足时通过sbrk扩展堆
+static struct umalloc_header *umalloc_carve(uint32_t size) {
+	struct umalloc_state *state = UMALLOC_STATE;
+	if(state->end - state->top < size) {
+		uint32_t grow = size > UMALLOC_GROW_SIZE ? size : UMALLOC_GROW_SIZE;
+		uint32_t old_brk = (uint32_t) sbrk(grow);
+		if(old_brk == (uint32_t) -1) {
+			return NULL;
+		}
+		// 堆末尾与上次记录的不同时(首次扩展),剩下的区域作废
+		if(old_brk != state->end) {
+			state->top = old_brk;
+		}
+		state->end = old_brk + grow;
+	}
+	struct umalloc_header *header = (struct umalloc_header*) state->top;
+	state->top += size;
+	header->size = size;
+	return header;
+}
+
+// 从释放的大内存块中找出第一个能容纳size字节且不会浪费一半以上的块
+static struct umalloc_header *umalloc_large_find(uint32_t size) {
+	struct umalloc_block **prev = &UMALLOC_STATE->large_list;
+	while(*prev != NULL) {
+		struct umalloc_block *block = *prev;
+		if(block->header.size >= size && block->header.size / 2 <= size) {
+			*prev = block->next;
+			return &block->header;
+		}
+		prev = &block->next;
+	}
+	return NULL;
+}
+
+// 申请size字节大小的内存
+void *malloc(uint32_t size) {
+	if(size == 0 || size > KERNEL_OFFSET - USER_HEAP_VADDR) {
+		return NULL;
+	}
+	uint32_t total = (size + sizeof(struct umalloc_header) + 7) & ~7;
+	struct umalloc_header *header;
+	uint32_t class = 0;
+	while(class < UMALLOC_CLASS_COUNT && (1U << (class + UMALLOC_MIN_SHIFT)) < total) {
+		++class;
+	}
+	if(class < UMALLOC_CLASS_COUNT) {
+		struct umalloc_block *block = UMALLOC_STATE->free_list[class];
+		if(block != NULL) {
+			UMALLOC_STATE->free_list[class] = block->next;
+			return (void*) (&block->header + 1);
+		}
+		header = umalloc_carve(1U << (class + UMALLOC_MIN_SHIFT));
+	} else {
+		header = umalloc_large_find(total);
+		if(header == NULL) {
+			header = umalloc_carve(total);
+		}
+	}
+	if(header == NULL) {
+		return NULL;
+	}
+	header->class = class;
+	return (void*) (header + 1);
+}
+
+// 释放ptr指向的内存,放回对应规格的空闲链表
+void free(void *ptr) {
+	if(ptr == NULL) {
+		return;
+	}
+	struct umalloc_block *block = (struct umalloc_block*) ((struct umalloc_header*) ptr - 1);
+	if(block->header.class == UMALLOC_LARGE) {
+		block->next = UMALLOC_STATE->large_list;
+		UMALLOC_STATE->large_list = block;
+	} else {
+		block->next = UMALLOC_STATE->free_list[block->header.class];
+		UMALLOC_STATE->free_list[block->header.class] = block;
+	}
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
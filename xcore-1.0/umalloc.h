@@ -0,0 +1,10 @@
+#ifndef __UMALLOC_H
+#define __UMALLOC_H
+
+#include "types.h"
+
+void *malloc(uint32_t size);
+
+void free(void *ptr);
+
+#endif
\ No newline at end of file
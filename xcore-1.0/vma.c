@@ -0,0 +1,240 @@
+#include "vma.h"
+#include "types.h"
+#include "global.h"
+#include "list.h"
+#include "debug.h"
+#include "slab.h"
+#include "inode.h"
+#include "shm.h"
+
+// 虚拟内存区域的cache
+static struct kmem_cache *vma_cache;
+
+// 新建描述[start, end)的vm_area,失败返回NULL
+static struct vm_area *vma_new(uint32_t start, uint32_t end) {
+	struct vm_area *vma = kmem_cache_alloc(vma_cache);
+	if(vma != NULL) {
+		vma->start = start;
+		vma->end = end;
+		vma->flags = 0;
+		vma->inode = NULL;
+		vma->offset = 0;
+		vma->shm = NULL;
+	}
+	return vma;
+}
+
+// 复制vma的映射属性到dst,映射文件时增加inode的打开数,映射共享内存段时增加段的映射数
+static void vma_share_mapping(struct vm_area *dst, struct vm_area *vma) {
+	dst->flags = vma->flags;
+	dst->inode = vma->inode;
+	dst->offset = vma->offset;
+	dst->shm = vma->shm;
+	if(vma->inode != NULL) {
+		++vma->inode->open_count;
+	}
+	if(vma->shm != NULL) {
+		shm_get(vma->shm);
+	}
+}
+
+// 释放vm_area,映射文件时关闭inode,映射共享内存段时减少段的映射数
+static void vma_release(struct vm_area *vma) {
+	if(vma->inode != NULL) {
+		inode_close(vma->inode);
+	}
+	if(vma->shm != NULL) {
+		shm_put(vma->shm);
+	}
+	kmem_cache_free(vma_cache, vma);
+}
+
+// 是否为可与相邻区域合并的普通匿名区域
+static bool vma_mergeable(struct vm_area *vma) {
+	return vma != NULL && vma->flags == 0 && vma->inode == NULL && vma->shm == NULL;
+}
+
+// 将[start, end)插入到vmas中next_ele之前,与前后相接的区域合并
+static bool vma_insert(struct list *vmas, struct list_ele *next_ele, \
+	uint32_t start, uint32_t end) {
+	struct vm_area *prev = NULL;
+	struct vm_area *next = NULL;
+	if(next_ele->prev != &vmas->head) {
+		prev = ELE2ENTRY(struct vm_area, vma_tag, next_ele->prev);
+	}
+	if(next_ele != &vmas->tail) {
+		next = ELE2ENTRY(struct vm_area, vma_tag, next_ele);
+	}
+	bool merge_prev = (vma_mergeable(prev) && prev->end == start);
+	bool merge_next = (vma_mergeable(next) && next->start == end);
+	if(merge_prev && merge_next) {
+		prev->end = next->end;
+		list_remove(&next->vma_tag);
+		kmem_cache_free(vma_cache, next);
+	} else if(merge_prev) {
+		prev->end = end;
+	} else if(merge_next) {
+		next->start = start;
+	} else {
+		struct vm_area *vma = vma_new(start, end);
+		if(vma == NULL) {
+			return false;
+		}
+		list_insert_before(next_ele, &vma->vma_tag);
+	}
+	return true;
+}
+
+// 在vmas中预留固定的地址[start, end),与已有区域重叠时失败
+bool vma_reserve(struct list *vmas, uint32_t start, uint32_t end) {
+	ASSERT(start < end && !(start & 0xfff) && !(end & 0xfff));
+	ASSERT(start >= USER_VADDR_START && end <= KERNEL_OFFSET);
+	struct list_ele *ele = vmas->head.next;
+	while(ele != &vmas->tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		if(vma->end > start) {
+			if(vma->start < end) {
+				return false;
+			}
+			break;
+		}
+		ele = ele->next;
+	}
+	return vma_insert(vmas, ele, start, end);
+}
+
+// 在用户空间中找到第一个能容纳size字节的空隙,返回起始地址,失败返回0
+// *next_ele为空隙之后的节点
+static uint32_t vma_find_gap(struct list *vmas, uint32_t size, struct list_ele **next_ele) {
+	ASSERT(size > 0 && !(size & 0xfff));
+	uint32_t gap_start = USER_VADDR_START;
+	struct list_ele *ele = vmas->head.next;
+	while(ele != &vmas->tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		if(vma->start - gap_start >= size) {
+			break;
+		}
+		gap_start = vma->end;
+		ele = ele->next;
+	}
+	if(ele == &vmas->tail && KERNEL_OFFSET - gap_start < size) {
+		return 0;
+	}
+	*next_ele = ele;
+	return gap_start;
+}
+
+// 在用户空间中找到第一个能容纳size字节的空隙并预留,返回起始地址,失败返回0
+uint32_t vma_alloc(struct list *vmas, uint32_t size) {
+	struct list_ele *ele;
+	uint32_t gap_start = vma_find_gap(vmas, size, &ele);
+	if(gap_start == 0 || !vma_insert(vmas, ele, gap_start, gap_start + size)) {
+		return 0;
+	}
+	return gap_start;
+}
+
+// 同vma_alloc,但预留的是不与其他区域合并的映射区域,返回起始地址,失败返回0
+// 映射文件时区域持有inode的一次打开,由调用者预先增加其打开数
+uint32_t vma_map(struct list *vmas, uint32_t size, uint32_t flags, \
+	struct inode *inode, uint32_t offset) {
+	struct list_ele *ele;
+	uint32_t gap_start = vma_find_gap(vmas, size, &ele);
+	if(gap_start == 0) {
+		return 0;
+	}
+	struct vm_area *vma = vma_new(gap_start, gap_start + size);
+	if(vma == NULL) {
+		return 0;
+	}
+	vma->flags = flags;
+	vma->inode = inode;
+	vma->offset = offset;
+	list_insert_before(ele, &vma->vma_tag);
+	return gap_start;
+}
+
+// 取消vmas中[start, end)的预留,区域被从中间拆开时需要新建一个vm_area,失败返回false
+bool vma_free(struct list *vmas, uint32_t start, uint32_t end) {
+	ASSERT(start < end && !(start & 0xfff) && !(end & 0xfff));
+	struct list_ele *ele = vmas->head.next;
+	while(ele != &vmas->tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		ele = ele->next;
+		if(vma->end <= start) {
+			continue;
+		}
+		if(vma->start >= end) {
+			break;
+		}
+		if(vma->start < start && vma->end > end) {
+			// 从中间拆成两段
+			struct vm_area *tail = vma_new(end, vma->end);
+			if(tail == NULL) {
+				return false;
+			}
+			vma_share_mapping(tail, vma);
+			tail->offset += end - vma->start;
+			vma->end = start;
+			list_insert_before(ele, &tail->vma_tag);
+			break;
+		} else if(vma->start < start) {
+			vma->end = start;
+		} else if(vma->end > end) {
+			vma->offset += end - vma->start;
+			vma->start = end;
+		} else {
+			list_remove(&vma->vma_tag);
+			vma_release(vma);
+		}
+	}
+	return true;
+}
+
+// 返回vmas中包含地址vaddr的区域,不存在时返回NULL
+struct vm_area *vma_find(struct list *vmas, uint32_t vaddr) {
+	struct list_ele *ele = vmas->head.next;
+	while(ele != &vmas->tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		if(vaddr < vma->start) {
+			break;
+		}
+		if(vaddr < vma->end) {
+			return vma;
+		}
+		ele = ele->next;
+	}
+	return NULL;
+}
+
+// 将src中的所有区域复制到空链表dst,失败时dst保持为空
+bool vma_copy(struct list *dst, struct list *src) {
+	ASSERT(list_empty(dst));
+	struct list_ele *ele = src->head.next;
+	while(ele != &src->tail) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, ele);
+		struct vm_area *copy = vma_new(vma->start, vma->end);
+		if(copy == NULL) {
+			vma_destroy(dst);
+			return false;
+		}
+		vma_share_mapping(copy, vma);
+		list_append(dst, &copy->vma_tag);
+		ele = ele->next;
+	}
+	return true;
+}
+
+// 释放vmas中的所有区域
+void vma_destroy(struct list *vmas) {
+	while(!list_empty(vmas)) {
+		struct vm_area *vma = ELE2ENTRY(struct vm_area, vma_tag, list_pop(vmas));
+		vma_release(vma);
+	}
+}
+
+// 创建vma_cache
+void vma_cache_init(void) {
+	vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0, NULL);
+	ASSERT(vma_cache != NULL);
+}
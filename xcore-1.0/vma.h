@@ -0,0 +1,41 @@
+#ifndef __VMA_H
+#define __VMA_H
+
+#include "types.h"
+#include "list.h"
+#include "inode.h"
+#include "shm.h"
+
+// 虚拟内存区域的标志
+#define VM_SHARED 0x1 // 共享映射,fork后父子进程共享页框,写入对彼此可见
+
+// 虚拟内存区域,描述进程用户空间中一段已预留的地址[start, end)
+// 普通的匿名区域flags为0且inode,shm为NULL,相邻时合并;映射区域不与其他区域合并
+struct vm_area {
+	uint32_t start; // 起始地址,按页对齐
+	uint32_t end; // 结束地址(不含),按页对齐
+	uint32_t flags; // VM_SHARED等标志
+	struct inode *inode; // 映射的文件,匿名区域为NULL,区域持有inode的一次打开
+	uint32_t offset; // start对应的文件偏移量,按页对齐;共享内存区域为段内偏移量
+	struct shm_segment *shm; // 映射的共享内存段,区域持有段的一次映射数
+	struct list_ele vma_tag; // 在进程vma_list中的节点,链表按地址升序排列
+};
+
+void vma_cache_init(void);
+
+bool vma_reserve(struct list *vmas, uint32_t start, uint32_t end);
+
+uint32_t vma_alloc(struct list *vmas, uint32_t size);
+
+uint32_t vma_map(struct list *vmas, uint32_t size, uint32_t flags, \
+	struct inode *inode, uint32_t offset);
+
+bool vma_free(struct list *vmas, uint32_t start, uint32_t end);
+
+struct vm_area *vma_find(struct list *vmas, uint32_t vaddr);
+
+bool vma_copy(struct list *dst, struct list *src);
+
+void vma_destroy(struct list *vmas);
+
+#endif
\ No newline at end of file
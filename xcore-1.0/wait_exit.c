@@ -0,0 +1,177 @@
+#include "wait_exit.h"
+#include "thread.h"
+#include "global.h"
+#include "memory.h"
+#include "process.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "list.h"
+#include "fs.h"
+
+extern struct list thread_all_list; // 所有任务队列
+
+#define INIT_PID 1 // init进程的pid,孤儿进程都过继给它
+
+// 释放进程pthread的用户空间,页目录和打开的文件,pthread必须是当前进程
+// PCB和0级栈此时仍在使用,由父进程在wait中回收
+static void release_prog_resource(struct task_struct *pthread) {
+	ASSERT(pthread == current_thread());
+	// 1 回收用户页,页表,交换槽和虚拟内存区域,写回共享的文件页
+	release_prog_space(pthread);
+	// 2 切换到内核页目录,回收页目录
+	pgdir_release(pthread);
+	// 3 关闭打开的文件
+	for(int32_t fd = 3; fd < PROC_MAX_FILE_OPEN; fd++) {
+		if(pthread->fd_table[fd] != -1) {
+			sys_close(fd);
+		}
+	}
+}
+
+// list_traversal的回调函数,查找父进程pid为ppid的子进程
+static bool find_child(struct list_ele *ele, int ppid) {
+	struct task_struct *pthread = ELE2ENTRY(struct task_struct, all_list_tag, ele);
+	return pthread->parent_pid == ppid;
+}
+
+// list_traversal的回调函数,查找父进程pid为ppid且已退出的子进程
+static bool find_hanging_child(struct list_ele *ele, int ppid) {
+	struct task_struct *pthread = ELE2ENTRY(struct task_struct, all_list_tag, ele);
+	return pthread->parent_pid == ppid && pthread->status == TASK_HANGING;
+}
+
+// list_traversal的回调函数,将父进程pid为ppid的子进程过继给init
+// 返回false以继续遍历
+static bool init_adopt_a_child(struct list_ele *ele, int ppid) {
+	struct task_struct *pthread = ELE2ENTRY(struct task_struct, all_list_tag, ele);
+	if(pthread->parent_pid == ppid) {
+		pthread->parent_pid = INIT_PID;
+	}
+	return false;
+}
+
+// 唤醒正在wait中等待的进程parent
+static void wake_waiting_parent(struct task_struct *parent) {
+	if(parent != NULL && parent->status == TASK_WAITING) {
+		thread_unblock(parent);
+	}
+}
+
+// 结束当前进程,status作为返回值交给父进程
+// 除PCB外的资源都在此归还,之后进程挂起,直到父进程通过wait回收
+void sys_exit(int32_t status) {
+	struct task_struct *cur_thread = current_thread();
+	ASSERT(cur_thread->pgdir != NULL);
+	if(cur_thread->pid == INIT_PID) {
+		PANIC("sys_exit : init can not exit");
+	}
+	// 由process_execute直接创建的进程没有父进程,交给init回收
+	if(cur_thread->parent_pid == -1) {
+		cur_thread->parent_pid = INIT_PID;
+	}
+	cur_thread->exit_status = status;
+	release_prog_resource(cur_thread);
+	// 以下过程不能被打断,否则父进程可能错过唤醒
+	disable_intr();
+	// 子进程过继给init,其中已退出的由init回收
+	list_traversal(&thread_all_list, init_adopt_a_child, cur_thread->pid);
+	if(list_traversal(&thread_all_list, find_hanging_child, INIT_PID) != NULL) {
+		wake_waiting_parent(pid2thread(INIT_PID));
+	}
+	struct task_struct *parent = pid2thread(cur_thread->parent_pid);
+	ASSERT(parent != NULL);
+	wake_waiting_parent(parent);
+	// 挂起后不再被调度
+	thread_block(TASK_HANGING);
+	PANIC("sys_exit : hanging task was scheduled");
+}
+
+// 等待子进程退出并回收其PCB,子进程的返回值存入status(可为NULL)
+// 成功返回子进程的pid,没有子进程时返回-1
+int32_t sys_wait(int32_t *status) {
+	struct task_struct *parent = current_thread();
+	while(1) {
+		enum intr_status old_status = get_intr_status();
+		disable_intr();
+		struct list_ele *child_ele = list_traversal(&thread_all_list, \
+			find_hanging_child, parent->pid);
+		if(child_ele != NULL) {
+			struct task_struct *child = ELE2ENTRY(struct task_struct, all_list_tag, child_ele);
+			int32_t exit_status = child->exit_status;
+			pid_t child_pid = child->pid;
+			set_intr_status(old_status);
+			thread_reap(child);
+			if(status != NULL) {
+				*status = exit_status;
+			}
+			return child_pid;
+		}
+		if(list_traversal(&thread_all_list, find_child, parent->pid) == NULL) {
+			set_intr_status(old_status);
+			return -1;
+		}
+		// 检查和阻塞之间关中断,子进程退出时一定能看到TASK_WAITING
+		thread_block(TASK_WAITING);
+		set_intr_status(old_status);
+	}
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
@@ -0,0 +1,10 @@
+#ifndef __WAIT_EXIT_H
+#define __WAIT_EXIT_H
+
+#include "types.h"
+
+void sys_exit(int32_t status);
+
+int32_t sys_wait(int32_t *status);
+
+#endif
\ No newline at end of file
@@ -3,6 +3,22 @@
 
 #include "types.h"
 
+// CPUID(eax=1)返回的edx中的特性位
+#define CPUID_EDX_PSE (1 << 3) // 支持4MB页
+#define CPUID_EDX_PGE (1 << 13) // 支持全局页
+#define CPUID_EDX_FXSR (1 << 24) // 支持fxsave/fxrstor
+#define CPUID_EDX_SSE2 (1 << 26) // 支持SSE2
+
+// CR0中的控制位
+#define CR0_MP (1 << 1) // 监控协处理器
+#define CR0_EM (1 << 2) // 置位时浮点和SSE指令产生异常
+#define CR0_WP (1 << 16) // 特权级0写只读页时也产生页错误
+
+// CR4中的控制位
+#define CR4_PSE (1 << 4) // 开启4MB页
+#define CR4_PGE (1 << 7) // 开启全局页
+#define CR4_OSFXSR (1 << 9) // 操作系统支持fxsave/fxrstor,开启SSE指令
+
 // 向端口port写入一个字节
 static inline void outb(uint16_t port, uint8_t data) {
 	__asm__ __volatile__("outb %b0, %w1" : : "a"(data), "dN"(port));
@@ -15,6 +31,18 @@ static inline uint8_t inb(uint16_t port) {
 	return data;
 }
 
+// 向端口port写入一个双字
+static inline void outl(uint16_t port, uint32_t data) {
+	__asm__ __volatile__("outl %0, %w1" : : "a"(data), "dN"(port));
+}
+
+// 从端口port读取一个双字返回
+static inline uint32_t inl(uint16_t port) {
+	uint32_t data;
+	__asm__ __volatile__("inl %w1, %0" : "=a"(data) : "dN"(port));
+	return data;
+}
+
 // 将addr处起始的count个字写入端口port
 static inline void outsw(uint16_t port, const void *addr, uint32_t count) {
 	__asm__ __volatile__("cld; rep outsw" : "+S"(addr), "+c"(count) : "d"(port));
@@ -25,4 +53,47 @@ static inline void insw(uint16_t port, void *addr, uint32_t count) {
 	__asm__ __volatile__("cld; rep insw" : "+D"(addr), "+c"(count) : "d"(port) : "memory");
 }
 
+// 执行cpuid指令,查询leaf号功能
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+	__asm__ __volatile__("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+// 读取时间戳计数器
+static inline uint64_t rdtsc(void) {
+	uint32_t low, high;
+	__asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t) high << 32) | low;
+}
+
+// 读取cr0
+static inline uint32_t read_cr0(void) {
+	uint32_t cr0;
+	__asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+	return cr0;
+}
+
+// 写入cr0
+static inline void write_cr0(uint32_t cr0) {
+	__asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+// 读取cr3
+static inline uint32_t read_cr3(void) {
+	uint32_t cr3;
+	__asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+	return cr3;
+}
+
+// 读取cr4
+static inline uint32_t read_cr4(void) {
+	uint32_t cr4;
+	__asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+
+// 写入cr4
+static inline void write_cr4(uint32_t cr4) {
+	__asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
 #endif
\ No newline at end of file